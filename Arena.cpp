@@ -0,0 +1,87 @@
+#include "Arena.h"
+
+#include <utility>
+#include <stdint.h>
+
+namespace scdl {
+
+Arena::Arena()
+    : next(NULL), n_left(0), bytes_allocated(0)
+{
+}
+
+Arena::~Arena()
+{
+    for (size_t i = 0; i < blocks.size(); i++)
+        delete[] blocks[i];
+}
+
+void *Arena::allocate(size_t size, size_t align)
+{
+    size_t padding = (align - (uintptr_t) next % align) % align;
+
+    if (next == NULL || padding + size > n_left) {
+        // Oversized requests get a block of their own so that the current
+        // block keeps serving the small ones
+        size_t block_size = size + align;
+        if (block_size <= ARENA_BLOCK_SIZE / 4)
+            block_size = ARENA_BLOCK_SIZE;
+
+        char *block = new char[block_size];
+        blocks.push_back(block);
+        padding = (align - (uintptr_t) block % align) % align;
+        if (block_size != ARENA_BLOCK_SIZE) {
+            bytes_allocated += size;
+            return block + padding;
+        }
+        next = block;
+        n_left = block_size;
+    }
+
+    void *p = next + padding;
+    next += padding + size;
+    n_left -= padding + size;
+    bytes_allocated += size;
+
+    return p;
+}
+
+Gate *Arena::new_input_gate(unsigned int index)
+{
+    Gate *g = static_cast<Gate*>(allocate(sizeof(Gate), alignof(Gate)));
+
+    g->type = GATE_IN;
+    g->input_index = index;
+    g->fan_in = 0;
+    g->origin = NO_ORIGIN;
+    g->in_gates = NULL;
+
+    return g;
+}
+
+Gate *Arena::new_operator_gate(GateType type, Gate *in1, Gate *in2)
+{
+    // sizeof(Gate) is a multiple of the alignment of Gate*
+    Gate *g = static_cast<Gate*>(allocate(sizeof(Gate) + 2 * sizeof(Gate*),
+                                          alignof(Gate)));
+
+    g->type = type;
+    g->input_index = 0;
+    g->fan_in = 2;
+    g->origin = NO_ORIGIN;
+    g->in_gates = reinterpret_cast<Gate**>(g + 1);
+    g->in_gates[0] = in1;
+    g->in_gates[1] = in2;
+
+    return g;
+}
+
+void Arena::swap(Arena &other)
+{
+    blocks.swap(other.blocks);
+    std::swap(next, other.next);
+    std::swap(n_left, other.n_left);
+    std::swap(bytes_allocated, other.bytes_allocated);
+}
+
+}
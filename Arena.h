@@ -0,0 +1,61 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdlib>
+
+#include "Circuit.h"
+
+namespace scdl {
+
+/* Size of the blocks an Arena carves its allocations from */
+#define ARENA_BLOCK_SIZE 65536
+
+/*
+ * Bump allocator that owns the gate graph of a program: the gates, their
+ * fan-in arrays and the other trivially destructible objects built while
+ * compiling (symbol gate arrays, RPN token arrays). Allocations are carved
+ * from large blocks and are only freed all at once, when the Arena is
+ * destroyed, so nothing allocated from it may need a destructor.
+ */
+class Arena {
+ public:
+    Arena();
+    ~Arena();
+
+    void *allocate(size_t size, size_t align=alignof(std::max_align_t));
+
+    template <class T>
+    T *allocate_array(size_t n) {
+        return static_cast<T*>(allocate(n * sizeof(T), alignof(T)));
+    }
+
+    /* The fan-in array of an operator gate is stored right after it */
+    Gate *new_input_gate(unsigned int index);
+    Gate *new_operator_gate(GateType type, Gate *in1, Gate *in2);
+
+    /* Hands the allocations over, e.g. from a compilation to its program */
+    void swap(Arena &other);
+
+    size_t get_num_blocks() const {
+        return blocks.size();
+    }
+
+    size_t get_bytes_allocated() const {
+        return bytes_allocated;
+    }
+
+ private:
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    std::vector<char*> blocks;
+    char *next;
+    size_t n_left;
+    size_t bytes_allocated;
+};
+
+}
+
+#endif // ARENA_H
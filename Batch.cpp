@@ -0,0 +1,383 @@
+#include "Batch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <charconv>
+#include <map>
+#include <json/json.h>
+
+namespace scdl {
+
+/* Strips spaces and a trailing carriage return */
+static void trim(const char *&begin, const char *&end)
+{
+    while (begin < end && (*begin == ' ' || *begin == '\t'))
+        begin++;
+    while (end > begin && (end[-1] == ' ' || end[-1] == '\t' ||
+                           end[-1] == '\r'))
+        end--;
+}
+
+static bool is_blank(const std::string &line)
+{
+    const char *begin = line.data();
+    const char *end = begin + line.size();
+    trim(begin, end);
+    return begin == end;
+}
+
+/* Checks that value fits in a variable of the given type and width */
+static void check_range(const Variable &var, size_t n_bits, int64_t value,
+                        bool is_negative)
+{
+    if (n_bits >= 64)
+        return;
+
+    if (var.type == VAR_INT) {
+        int64_t limit = (int64_t) 1 << (n_bits - 1);
+        if (value >= limit || value < -limit)
+            throw "Value out of range for its variable";
+    }
+    else if (is_negative || ((uint64_t) value >> n_bits) != 0)
+        throw "Value out of range for its variable";
+}
+
+static uint64_t parse_text_value(const Variable &var, size_t n_bits,
+                                 const char *begin, const char *end)
+{
+    trim(begin, end);
+
+    if (var.type == VAR_BOOL) {
+        std::string text(begin, end);
+        std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+        if (text == "true" || text == "1")
+            return 1;
+        if (text == "false" || text == "0")
+            return 0;
+        throw "Invalid value for bool type";
+    }
+
+    std::from_chars_result r;
+    uint64_t value;
+    bool is_negative = begin < end && *begin == '-';
+    if (var.type == VAR_INT) {
+        int64_t n;
+        r = std::from_chars(begin, end, n);
+        value = n;
+    }
+    else
+        r = std::from_chars(begin, end, value);
+
+    if (r.ec != std::errc() || r.ptr != end || begin == end)
+        throw "Invalid integer value";
+    check_range(var, n_bits, value, is_negative);
+
+    return value;
+}
+
+static uint64_t parse_json_value(const Variable &var, size_t n_bits,
+                                 json_object *obj)
+{
+    json_type type = json_object_get_type(obj);
+
+    if (var.type == VAR_BOOL) {
+        if (type == json_type_boolean)
+            return json_object_get_boolean(obj);
+        if (type == json_type_int) {
+            int64_t n = json_object_get_int64(obj);
+            if (n == 0 || n == 1)
+                return n;
+        }
+        throw "Invalid value for bool type";
+    }
+
+    if (type != json_type_int)
+        throw "Invalid integer value";
+
+    int64_t n = json_object_get_int64(obj);
+    uint64_t value = n;
+    if (var.type == VAR_UINT && n >= 0)
+        value = json_object_get_uint64(obj);
+    check_range(var, n_bits, value, var.type == VAR_UINT && n < 0);
+
+    return value;
+}
+
+BatchFormat BatchEvaluator::parse_format(const std::string &name)
+{
+    if (name == "csv")
+        return BATCH_CSV;
+    if (name == "jsonl")
+        return BATCH_JSON_LINES;
+    throw "Unknown batch format";
+}
+
+BatchEvaluator::BatchEvaluator(const compiler::SCDLProgram *prog,
+                               const Vars &vars, BatchFormat format)
+    : prog(prog), format(format), slicer(prog), line_number(0)
+{
+    for (size_t i = 0; i < vars.inputs.size(); i++) {
+        InputField field;
+        field.var = vars.inputs[i];
+        field.n_bits = 0;
+        if (field.var.type == VAR_BITSTRING)
+            throw "Unknown type";
+        if (field.var.components.empty())
+            throw "No components for input variable";
+
+        for (size_t j = 0; j < field.var.components.size(); j++) {
+            const std::string &comp = field.var.components[j];
+            if (!prog->has_variable(comp))
+                throw "Cannot find component input in SCDL program";
+            field.components.push_back(prog->get_variable(comp));
+            field.n_bits += field.components.back().len;
+        }
+        inputs.push_back(field);
+    }
+
+    wires = output_wires(vars);
+    std::map<std::string,size_t> wire_index;
+    for (size_t i = 0; i < wires.size(); i++) {
+        if (!prog->has_circuit(wires[i])) {
+            std::cerr << "Output wire " << wires[i]
+                      << " is not a function of the program" << std::endl;
+            throw "Could not find definition for output wire";
+        }
+        wire_index[wires[i]] = i;
+    }
+    prog->get_cone(wires, cone);
+
+    for (size_t i = 0; i < vars.outputs.size(); i++) {
+        OutputField field;
+        field.var = vars.outputs[i];
+        if (field.var.type == VAR_BITSTRING)
+            throw "Unsupported type";
+        if (field.var.type == VAR_BOOL && field.var.components.size() != 1)
+            throw "Number of components for type bool should be 1";
+        if (field.var.components.size() > 64)
+            throw "Output variable wider than 64 bits";
+
+        for (size_t j = 0; j < field.var.components.size(); j++)
+            field.wires.push_back(wire_index[field.var.components[j]]);
+        outputs.push_back(field);
+    }
+}
+
+void BatchEvaluator::set_input(const InputField &field, size_t lane,
+                               uint64_t value)
+{
+    // The low bits go to the first component, as in read_variable
+    for (size_t i = 0; i < field.components.size(); i++) {
+        const compiler::Variable &comp = field.components[i];
+        slicer.set_lane(comp, lane, value);
+        value = (comp.len < 64) ? value >> comp.len : 0;
+    }
+}
+
+void BatchEvaluator::read_csv_header(std::istream &in)
+{
+    while (std::getline(in, line)) {
+        line_number++;
+        if (!is_blank(line))
+            break;
+    }
+    if (!in)
+        return;
+
+    std::vector<bool> seen(inputs.size(), false);
+    const char *p = line.data();
+    const char *line_end = p + line.size();
+    for (;;) {
+        const char *end = std::find(p, line_end, ',');
+        const char *begin = p;
+        trim(begin, end);
+        std::string name(begin, end);
+
+        size_t i = 0;
+        while (i < inputs.size() && inputs[i].var.name != name)
+            i++;
+        if (i == inputs.size())
+            throw "Unknown input variable in CSV header";
+        if (seen[i])
+            throw "Duplicate input variable in CSV header";
+        seen[i] = true;
+        columns.push_back(i);
+
+        p = std::find(p, line_end, ',');
+        if (p == line_end)
+            break;
+        p++;
+    }
+
+    if (std::find(seen.begin(), seen.end(), false) != seen.end())
+        throw "Missing input variable in CSV header";
+}
+
+/*
+ * Reads the next record into the given lane. Returns false at the end of
+ * the input.
+ */
+bool BatchEvaluator::read_record(std::istream &in, size_t lane)
+{
+    do {
+        if (!std::getline(in, line))
+            return false;
+        line_number++;
+    } while (is_blank(line));
+
+    if (format == BATCH_CSV) {
+        const char *p = line.data();
+        const char *line_end = p + line.size();
+        for (size_t col = 0; col < columns.size(); col++) {
+            if (p > line_end)
+                throw "Too few values in CSV record";
+            const char *end = std::find(p, line_end, ',');
+            const InputField &field = inputs[columns[col]];
+            set_input(field, lane,
+                      parse_text_value(field.var, field.n_bits, p, end));
+            p = end + 1;
+        }
+        if (p <= line_end)
+            throw "Too many values in CSV record";
+        return true;
+    }
+
+    json_object *obj = json_tokener_parse(line.c_str());
+    if (obj == NULL || json_object_get_type(obj) != json_type_object) {
+        json_object_put(obj);
+        throw "Invalid JSON record";
+    }
+    try {
+        for (size_t i = 0; i < inputs.size(); i++) {
+            const InputField &field = inputs[i];
+            json_object *value;
+            if (!json_object_object_get_ex(obj, field.var.name.c_str(),
+                                           &value))
+                throw "Missing input variable in JSON record";
+            set_input(field, lane,
+                      parse_json_value(field.var, field.n_bits, value));
+        }
+    }
+    catch (const char *) {
+        json_object_put(obj);
+        throw;
+    }
+    json_object_put(obj);
+
+    return true;
+}
+
+void BatchEvaluator::write_header(std::string &buf) const
+{
+    if (format != BATCH_CSV)
+        return;
+
+    for (size_t i = 0; i < outputs.size(); i++) {
+        if (i > 0)
+            buf += ',';
+        buf += outputs[i].var.name;
+    }
+    buf += '\n';
+}
+
+void BatchEvaluator::write_value(const OutputField &field, size_t lane,
+                                 std::string &buf) const
+{
+    size_t n_words = slicer.get_num_words();
+    size_t word = lane / 64;
+    size_t bit = lane % 64;
+
+    uint64_t n = 0;
+    for (size_t i = 0; i < field.wires.size(); i++) {
+        uint64_t w = results[field.wires[i] * n_words + word];
+        n |= ((w >> bit) & 1) << i;
+    }
+
+    const size_t n_bits = field.wires.size();
+    switch (field.var.type) {
+        case VAR_INT:
+            // convert from 2's complement
+            if (n_bits > 0 && n_bits < 64 && (n >> (n_bits - 1)) & 1)
+                n |= ~(uint64_t) 0 << n_bits;
+            buf += std::to_string((int64_t) n);
+            break;
+        case VAR_UINT:
+            buf += std::to_string(n);
+            break;
+        default:
+            buf += (n) ? "true" : "false";
+            break;
+    }
+}
+
+void BatchEvaluator::write_records(size_t n_records, std::string &buf) const
+{
+    for (size_t lane = 0; lane < n_records; lane++) {
+        if (format == BATCH_JSON_LINES)
+            buf += '{';
+        for (size_t i = 0; i < outputs.size(); i++) {
+            if (i > 0)
+                buf += ',';
+            if (format == BATCH_JSON_LINES) {
+                buf += '"';
+                buf += outputs[i].var.name;
+                buf += "\":";
+            }
+            write_value(outputs[i], lane, buf);
+        }
+        if (format == BATCH_JSON_LINES)
+            buf += '}';
+        buf += '\n';
+    }
+}
+
+BatchStats BatchEvaluator::run(std::istream &in, std::ostream &out)
+{
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+
+    BatchStats stats;
+    std::string buf;
+    line_number = 0;
+    columns.clear();
+
+    try {
+        if (format == BATCH_CSV)
+            read_csv_header(in);
+        write_header(buf);
+
+        size_t n_lanes = slicer.get_num_lanes();
+        for (;;) {
+            size_t n_records = 0;
+            while (n_records < n_lanes && read_record(in, n_records))
+                n_records++;
+            if (n_records == 0)
+                break;
+
+            if (!wires.empty())
+                slicer.run(cone, results);
+            write_records(n_records, buf);
+            out.write(buf.data(), buf.size());
+            buf.clear();
+
+            stats.n_records += n_records;
+            if (n_records < n_lanes)
+                break;
+        }
+    }
+    catch (const char *) {
+        std::cerr << "Error in batch record at line " << line_number
+                  << std::endl;
+        throw;
+    }
+
+    out.write(buf.data(), buf.size());
+    out.flush();
+
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+    stats.seconds = d.count();
+
+    return stats;
+}
+
+}
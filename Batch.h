@@ -0,0 +1,91 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <stdint.h>
+
+#include "SCDLProgram.h"
+#include "SCDLEvaluator.h"
+#include "BitSlice.h"
+
+namespace scdl {
+
+enum BatchFormat {
+    BATCH_CSV,          // a header line naming the variables, then one
+                        // comma-separated record per line
+    BATCH_JSON_LINES    // one JSON object per line, keyed by variable name
+};
+
+struct BatchStats {
+    BatchStats() : n_records(0), seconds(0) {}
+
+    size_t n_records;
+    double seconds;     // reading, evaluation and writing
+};
+
+/*
+ * Non-interactive evaluation of a stream of input records. Every record
+ * assigns a value to each input of the .vars metadata, typed the same way
+ * as in the interactive mode: uint and int values are decimal integers
+ * that fit in the width of the variable, bool values are true or false.
+ * One output record is written per input record, in the same format, with
+ * the outputs of the .vars metadata in their order.
+ *
+ * Records are evaluated by the bit-sliced backend, one lane per record, so
+ * the cone of all output wires in the gate pool is evaluated once for every
+ * get_num_lanes() records.
+ */
+class BatchEvaluator {
+ public:
+    BatchEvaluator(const compiler::SCDLProgram *prog, const Vars &vars,
+                   BatchFormat format=BATCH_CSV);
+    //       throws const char *;
+
+    /* Evaluates the records of in until its end */
+    BatchStats run(std::istream &in, std::ostream &out);
+    //       throws const char *;
+
+    /* "csv" or "jsonl" */
+    static BatchFormat parse_format(const std::string &name);
+    //       throws const char *;
+
+ private:
+    struct InputField {
+        Variable var;
+        size_t n_bits;
+        std::vector<compiler::Variable> components;
+    };
+
+    struct OutputField {
+        Variable var;
+        std::vector<size_t> wires;  // index in wires of each bit
+    };
+
+    bool read_record(std::istream &in, size_t lane);
+    void read_csv_header(std::istream &in);
+    void set_input(const InputField &field, size_t lane, uint64_t value);
+    void write_header(std::string &buf) const;
+    void write_records(size_t n_records, std::string &buf) const;
+    void write_value(const OutputField &field, size_t lane,
+                     std::string &buf) const;
+
+    const compiler::SCDLProgram *prog;
+    BatchFormat format;
+    BitSliceEvaluator slicer;
+
+    std::vector<InputField> inputs;
+    std::vector<size_t> columns;    // input field of each CSV column
+    std::vector<OutputField> outputs;
+    std::vector<std::string> wires;
+    CircuitCone cone;   // of wires
+    std::vector<uint64_t> results;
+    std::string line;
+    size_t line_number;
+};
+
+}
+
+#endif // BATCH_H
@@ -0,0 +1,272 @@
+#include "BitSlice.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace scdl {
+
+/*
+ * Block of 256 and 512 lanes. GCC lowers operations on these to single
+ * AVX2/AVX-512 instructions inside the functions compiled for those
+ * targets below.
+ */
+typedef uint64_t slice256 __attribute__((vector_size(32)));
+typedef uint64_t slice512 __attribute__((vector_size(64)));
+
+/*
+ * Evaluates the gates of a cone of the circuit with one block of type V per
+ * wire. values holds a block for every value slot of the circuit (see
+ * Circuit::get_num_slots), so an output wire is the block at the slot of
+ * its output gate. The gates of a cone are in the order of the circuit, so
+ * their slots are used as in a pass over the whole circuit (see
+ * Circuit::eval_iterative_cone).
+ */
+template <class V>
+static inline void eval_slices(const Circuit *circuit, const CircuitCone &cone,
+                               const uint64_t *inputs, uint64_t *values)
+{
+    const size_t W = sizeof(V) / sizeof(uint64_t);
+
+    for (size_t k = 0; k < cone.get_num_gates(); k++) {
+        unsigned int i = cone.get_gate_index(k);
+        GateType type = circuit->get_gate_type(i);
+        const unsigned int *in_gates = circuit->get_in_gates(i);
+        V acc;
+
+        if (type == GATE_IN)
+            memcpy(&acc, inputs + in_gates[0] * W, sizeof(V));
+        else
+            memcpy(&acc, values + circuit->get_slot(in_gates[0]) * W,
+                   sizeof(V));
+
+        size_t fan_in = circuit->get_fan_in(i);
+        for (size_t j = 1; j < fan_in; j++) {
+            V b;
+            memcpy(&b, values + circuit->get_slot(in_gates[j]) * W,
+                   sizeof(V));
+            if (type == GATE_MULT)
+                acc &= b;
+            else if (type == GATE_ADD)
+                acc ^= b;
+        }
+
+        memcpy(values + circuit->get_slot(i) * W, &acc, sizeof(V));
+    }
+}
+
+/* Same as above for a width that is only known at runtime */
+static void eval_slices_generic(const Circuit *circuit,
+                                const CircuitCone &cone, size_t n_words,
+                                const uint64_t *inputs, uint64_t *values)
+{
+    // A gate may take over the slot of any operand it is the last user of,
+    // so the result is accumulated aside before being stored
+    std::vector<uint64_t> acc(n_words);
+    uint64_t *v = &acc[0];
+
+    for (size_t k = 0; k < cone.get_num_gates(); k++) {
+        unsigned int i = cone.get_gate_index(k);
+        GateType type = circuit->get_gate_type(i);
+        const unsigned int *in_gates = circuit->get_in_gates(i);
+        uint64_t *out = values + circuit->get_slot(i) * n_words;
+
+        if (type == GATE_IN) {
+            std::copy(inputs + in_gates[0] * n_words,
+                      inputs + (in_gates[0] + 1) * n_words, out);
+            continue;
+        }
+
+        const uint64_t *a = values + circuit->get_slot(in_gates[0]) * n_words;
+        std::copy(a, a + n_words, v);
+        for (size_t j = 1; j < circuit->get_fan_in(i); j++) {
+            const uint64_t *b = values + circuit->get_slot(in_gates[j]) *
+                                         n_words;
+            if (type == GATE_MULT) {
+                for (size_t w = 0; w < n_words; w++)
+                    v[w] &= b[w];
+            }
+            else if (type == GATE_ADD) {
+                for (size_t w = 0; w < n_words; w++)
+                    v[w] ^= b[w];
+            }
+        }
+        std::copy(v, v + n_words, out);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx512f")))
+static void eval_slices_avx512(const Circuit *circuit, const CircuitCone &cone,
+                               const uint64_t *inputs, uint64_t *values)
+{
+    eval_slices<slice512>(circuit, cone, inputs, values);
+}
+
+__attribute__((target("avx2")))
+static void eval_slices_avx2(const Circuit *circuit, const CircuitCone &cone,
+                             const uint64_t *inputs, uint64_t *values)
+{
+    eval_slices<slice256>(circuit, cone, inputs, values);
+}
+#endif
+
+
+BitSliceEvaluator::BitSliceEvaluator(const compiler::SCDLProgram *prog,
+                                     size_t n_words)
+    : prog(prog), n_words(n_words)
+{
+    if (this->n_words == 0)
+        this->n_words = native_num_words();
+
+    n_circuit_inputs = prog->get_num_variable_inputs() +
+                       prog->get_num_constants();
+    inputs.resize(n_circuit_inputs * this->n_words);
+    clear();
+}
+
+size_t BitSliceEvaluator::native_num_words()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx512f"))
+        return 8;
+    if (__builtin_cpu_supports("avx2"))
+        return 4;
+#endif
+    return 1;
+}
+
+void BitSliceEvaluator::clear()
+{
+    std::fill(inputs.begin(), inputs.end(), 0);
+
+    // Constants are the same in every lane
+    for (size_t i = 0; i < prog->get_num_constants(); i++) {
+        compiler::Constant c = prog->get_constant(i);
+        uint64_t word = (c.value % 2) ? ~(uint64_t) 0 : 0;
+        std::fill(inputs.begin() + c.input_index * n_words,
+                  inputs.begin() + (c.input_index + 1) * n_words, word);
+    }
+}
+
+/* A lane of a variable is exchanged as one uint64_t */
+static void check_width(const compiler::Variable &var)
+{
+    if (var.len > 64)
+        throw "Variable wider than 64 bits";
+}
+
+void BitSliceEvaluator::set_lane(const compiler::Variable &var, size_t lane,
+                                 uint64_t value)
+{
+    check_width(var);
+    if (lane >= get_num_lanes())
+        throw "Lane out of range";
+
+    size_t word = lane / 64;
+    uint64_t mask = (uint64_t) 1 << (lane % 64);
+
+    for (size_t i = 0; i < var.len; i++) {
+        uint64_t &w = inputs[(var.input_index + i) * n_words + word];
+        if ((value >> i) & 1)
+            w |= mask;
+        else
+            w &= ~mask;
+    }
+}
+
+uint64_t BitSliceEvaluator::get_lane(const compiler::Variable &var,
+                                     size_t lane) const
+{
+    check_width(var);
+    if (lane >= get_num_lanes())
+        throw "Lane out of range";
+
+    size_t word = lane / 64;
+    uint64_t value = 0;
+
+    for (size_t i = 0; i < var.len; i++) {
+        uint64_t w = inputs[(var.input_index + i) * n_words + word];
+        value |= ((w >> (lane % 64)) & 1) << i;
+    }
+
+    return value;
+}
+
+void BitSliceEvaluator::pack_variable(const compiler::Variable &var,
+                                      const uint64_t *values, size_t n_values)
+{
+    check_width(var);
+    if (n_values > get_num_lanes())
+        throw "Too many values for the number of lanes";
+
+    for (size_t i = 0; i < var.len; i++) {
+        uint64_t *words = &inputs[(var.input_index + i) * n_words];
+        std::fill(words, words + n_words, 0);
+        for (size_t lane = 0; lane < n_values; lane++)
+            words[lane / 64] |= ((values[lane] >> i) & 1) << (lane % 64);
+    }
+}
+
+void BitSliceEvaluator::run(const std::string &circuit_name,
+                            uint64_t *result) const
+{
+    CircuitCone cone;
+    prog->get_cone(circuit_name, cone);
+    std::vector<uint64_t> results;
+    run(cone, results);
+    std::copy(results.begin(), results.end(), result);
+}
+
+void BitSliceEvaluator::run(const std::vector<std::string> &circuit_names,
+                            std::vector<uint64_t> &results) const
+{
+    CircuitCone cone;
+    prog->get_cone(circuit_names, cone);
+    run(cone, results);
+}
+
+void BitSliceEvaluator::run(const CircuitCone &cone,
+                            std::vector<uint64_t> &results) const
+{
+    const Circuit *pool = prog->get_gate_pool();
+
+    std::vector<uint64_t> values(pool->get_num_slots() * n_words);
+    eval_cone(pool, cone, &values[0]);
+
+    results.resize(cone.get_num_outputs() * n_words);
+    for (size_t i = 0; i < cone.get_num_outputs(); i++) {
+        size_t out = pool->get_slot(cone.get_output_gate_index(i)) * n_words;
+        std::copy(values.begin() + out, values.begin() + out + n_words,
+                  results.begin() + i * n_words);
+    }
+}
+
+void BitSliceEvaluator::eval_cone(const Circuit *circuit,
+                                  const CircuitCone &cone,
+                                  uint64_t *values) const
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (n_words == 8 && __builtin_cpu_supports("avx512f"))
+        eval_slices_avx512(circuit, cone, &inputs[0], values);
+    else if (n_words == 4 && __builtin_cpu_supports("avx2"))
+        eval_slices_avx2(circuit, cone, &inputs[0], values);
+    else
+#endif
+    if (n_words == 1)
+        eval_slices<uint64_t>(circuit, cone, &inputs[0], values);
+    else
+        eval_slices_generic(circuit, cone, n_words, &inputs[0], values);
+}
+
+uint64_t BitSliceEvaluator::unpack(const std::vector<const uint64_t*> &wires,
+                                   size_t lane)
+{
+    uint64_t value = 0;
+
+    for (size_t i = 0; i < wires.size(); i++)
+        value |= ((wires[i][lane / 64] >> (lane % 64)) & 1) << i;
+
+    return value;
+}
+
+}
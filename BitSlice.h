@@ -0,0 +1,102 @@
+#ifndef BIT_SLICE_H
+#define BIT_SLICE_H
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <stdint.h>
+
+#include "Circuit.h"
+#include "SCDLProgram.h"
+
+namespace scdl {
+
+/*
+ * Bit-sliced plaintext backend. Every wire carries n_words 64-bit words and
+ * bit j of word w holds the value of the wire under input assignment
+ * (64 * w + j), so one pass over a circuit evaluates 64 * n_words
+ * independent assignments. GATE_MULT is evaluated as AND and GATE_ADD as
+ * XOR.
+ */
+class BitSliceEvaluator {
+ public:
+    /*
+     * If n_words is 0 the width is chosen at runtime from the vector
+     * extensions supported by the CPU (8 words with AVX-512, 4 words with
+     * AVX2 and 1 word otherwise).
+     */
+    BitSliceEvaluator(const compiler::SCDLProgram *prog, size_t n_words=0);
+
+    size_t get_num_words() const {
+        return n_words;
+    }
+
+    size_t get_num_lanes() const {
+        return 64 * n_words;
+    }
+
+    /* Sets every lane of every variable to zero */
+    void clear();
+
+    /*
+     * The methods below exchange the value of var in a lane as a uint64_t,
+     * so they throw if var is wider than 64 bits.
+     */
+
+    /* Packs value (its low var.len bits) into the given lane of var */
+    void set_lane(const compiler::Variable &var, size_t lane, uint64_t value);
+
+    /* Returns the value of var in the given lane */
+    uint64_t get_lane(const compiler::Variable &var, size_t lane) const;
+
+    /*
+     * Packs n_values assignments of var into lanes 0 to (n_values - 1).
+     * Unused lanes are set to zero.
+     */
+    void pack_variable(const compiler::Variable &var, const uint64_t *values,
+                       size_t n_values);
+
+    /*
+     * Evaluates the named circuit over all lanes and stores the n_words
+     * words of its output wire in result.
+     */
+    void run(const std::string &circuit_name, uint64_t *result) const;
+
+    /*
+     * Evaluates the union of the named circuits in one pass, so the gates
+     * they share are computed once. results receives the n_words words of
+     * each output wire, in the order of circuit_names.
+     */
+    void run(const std::vector<std::string> &circuit_names,
+             std::vector<uint64_t> &results) const;
+
+    /*
+     * Same as above over a cone of the gate pool of the program (see
+     * SCDLProgram::get_cone), which callers that evaluate the same
+     * functions many times compute once
+     */
+    void run(const CircuitCone &cone, std::vector<uint64_t> &results) const;
+
+    /*
+     * Reassembles the value in the given lane from a set of output wires,
+     * where wires[i] holds the words of bit i.
+     */
+    static uint64_t unpack(const std::vector<const uint64_t*> &wires,
+                           size_t lane);
+
+    /* Number of words that match the widest vector unit of this CPU */
+    static size_t native_num_words();
+
+ private:
+    void eval_cone(const Circuit *circuit, const CircuitCone &cone,
+                   uint64_t *values) const;
+
+    const compiler::SCDLProgram *prog;
+    size_t n_words;
+    size_t n_circuit_inputs;
+    std::vector<uint64_t> inputs;
+};
+
+}
+
+#endif // BIT_SLICE_H
@@ -4,130 +4,405 @@
 
 
 #include <algorithm>
+#include <unordered_set>
 
 namespace scdl {
 
-void Circuit::count_gates()
+void Circuit::build(const std::vector<Gate*> &output_gates)
 {
-    n_add_gates = 0;
-    n_mult_gates = 0;
-    for (int i = 0; i < gates.size(); i++)
-        gates[i].visited = false;
-    count_gates_rec(output_gate_index);
-    
+    if (output_gates.empty())
+        throw "Circuit has no output gate";
+
+    GateIndexMap visited;
+    std::vector<Gate*> order;
+    std::vector<unsigned int> outputs;
+    for (size_t i = 0; i < output_gates.size(); i++) {
+        unsigned int index;
+        if (!check_well_formed(order, output_gates[i], visited, &index))
+            throw "Circuit not well formed";
+        outputs.push_back(index);
+    }
+    output_gate_indices.assign(outputs);
+    output_gate_index = output_gate_indices[0];
+    store_gates(order, visited);
+    analyze();
 }
 
-void Circuit::count_gates_rec(unsigned int gate_index)
+/*
+ * Everything that follows from the stored gates. The value slots do not
+ * depend on the statistics, so the two are computed concurrently; each
+ * section only writes its own members, so the result does not depend on
+ * the number of threads.
+ */
+void Circuit::analyze()
 {
-    InternalGate &gate = gates[gate_index];
-    if (gate.visited)
-        return;
+    #pragma omp parallel sections
+    {
+        #pragma omp section
+        {
+            CircuitStats stats(this);
+            mult_depth = stats.get_mult_depth();
+            n_mult_gates = stats.get_num_mult_gates();
+            n_add_gates = stats.get_num_add_gates();
+            compute_levels(stats);
+        }
+        #pragma omp section
+        allocate_slots();
+    }
+}
 
-    gate.visited = true;
+Circuit::Circuit(const CircuitLayout &layout)
+    : n_inputs(layout.n_inputs), n_add_gates(layout.n_add_gates),
+      n_mult_gates(layout.n_mult_gates), mult_depth(layout.mult_depth),
+      n_slots(layout.n_slots)
+{
+    binary = layout.binary;
+    gate_types.refer(layout.gate_types, layout.n_gates);
+    if (!binary)
+        operand_offsets.refer(layout.operand_offsets, layout.n_gates + 1);
+    operands.refer(layout.operands, layout.n_operands);
+    output_gate_indices.refer(layout.output_gate_indices, layout.n_outputs);
+    level_offsets.refer(layout.level_offsets, layout.n_levels + 1);
+    level_gates.refer(layout.level_gates, layout.n_gates);
+    slot_of.refer(layout.slot_of, layout.n_gates);
+    if (layout.origins != NULL)
+        origins.refer(layout.origins, layout.n_gates);
+
+    if (layout.n_outputs == 0)
+        throw "Circuit has no output gate";
+    output_gate_index = output_gate_indices[0];
+}
 
-    if (gate.type == GATE_MULT)
-        n_mult_gates++;
-    else if (gate.type == GATE_ADD)
-        n_add_gates++;
+CircuitLayout Circuit::get_layout() const
+{
+    CircuitLayout layout;
+
+    layout.n_inputs = n_inputs;
+    layout.n_add_gates = n_add_gates;
+    layout.n_mult_gates = n_mult_gates;
+    layout.n_slots = n_slots;
+    layout.mult_depth = mult_depth;
+    layout.binary = binary;
+    layout.n_gates = gate_types.size();
+    layout.n_operands = operands.size();
+    layout.n_outputs = output_gate_indices.size();
+    layout.n_levels = get_num_levels();
+    layout.gate_types = gate_types.data();
+    layout.operand_offsets = binary ? NULL : operand_offsets.data();
+    layout.operands = operands.data();
+    layout.output_gate_indices = output_gate_indices.data();
+    layout.level_offsets = level_offsets.data();
+    layout.level_gates = level_gates.data();
+    layout.slot_of = slot_of.data();
+    layout.origins = origins.empty() ? NULL : origins.data();
+
+    return layout;
+}
 
-    for (int i = 0; i < gate.fan_in; i++)
-        count_gates_rec(gate.in_gates[i]);    
+/* Buckets the gates by level (counting sort) */
+void Circuit::compute_levels(const CircuitStats &stats)
+{
+    size_t n_gates = get_num_gates();
+    size_t n_levels = stats.get_num_levels();
+    std::vector<unsigned int> offsets(n_levels + 1, 0);
+    for (size_t i = 0; i < n_gates; i++)
+        offsets[stats.get_level(i) + 1]++;
+    for (size_t l = 0; l < n_levels; l++)
+        offsets[l + 1] += offsets[l];
+
+    std::vector<unsigned int> next(offsets.begin(), offsets.end() - 1);
+    std::vector<unsigned int> by_level(n_gates);
+    for (size_t i = 0; i < n_gates; i++)
+        by_level[next[stats.get_level(i)]++] = i;
+
+    level_offsets.assign(offsets);
+    level_gates.assign(by_level);
 }
-    
-int Circuit::compute_depth()
+
+/*
+ * Register allocation for gate values. A gate's value is live from the
+ * point it is computed until its last consumer in the gates order has run
+ * (output gates stay live until the end). Slots are handed out from a free
+ * list, so the number of slots is the peak number of live values, which
+ * follows the width of the circuit rather than its size.
+ */
+void Circuit::allocate_slots()
 {
-    for (int i = 0; i < gates.size(); i++) {
-        gates[i].visited = false;
-        gates[i].depth = 0;
+    size_t n_gates = get_num_gates();
+    const unsigned int never = n_gates;
+    std::vector<unsigned int> last_use(n_gates, 0);
+    for (size_t i = 0; i < n_gates; i++) {
+        const unsigned int *in_gates = get_in_gates(i);
+        for (size_t j = 0; j < get_fan_in(i); j++)
+            last_use[in_gates[j]] = i;
     }
+    for (size_t i = 0; i < output_gate_indices.size(); i++)
+        last_use[output_gate_indices[i]] = never;
+
+    std::vector<unsigned int> free_slots;
+    std::vector<bool> released(n_gates, false);
+    std::vector<unsigned int> slots(n_gates, 0);
+    n_slots = 0;
+
+    for (size_t i = 0; i < n_gates; i++) {
+        const unsigned int *in_gates = get_in_gates(i);
+
+        // Operands that die here hand their slot over, possibly to this
+        // very gate (evaluation writes the result after reading them)
+        for (size_t j = 0; j < get_fan_in(i); j++) {
+            unsigned int in = in_gates[j];
+            if (last_use[in] == i && !released[in]) {
+                released[in] = true;
+                free_slots.push_back(slots[in]);
+            }
+        }
 
-    return compute_depth_rec(output_gate_index, 0);
+        if (free_slots.empty()) {
+            slots[i] = n_slots++;
+        }
+        else {
+            slots[i] = free_slots.back();
+            free_slots.pop_back();
+        }
+    }
+    slot_of.assign(slots);
 }
 
-int Circuit::compute_depth_rec(unsigned int gate_index, int depth) {
-    InternalGate &gate = gates[gate_index];
-
-    if (gate.visited) {
-        return depth + gate.depth;
+/*
+ * Appends the gates below output_gate that are not in visited yet to order
+ * in post-order, so every gate comes after its inputs, and records the
+ * index of each in visited. The walk keeps its own stack, so the depth of
+ * the circuit is not limited by that of the call stack.
+ */
+bool Circuit::check_well_formed(std::vector<Gate*> &order, Gate *output_gate,
+                                GateIndexMap &visited,
+                                unsigned int *gate_index)
+{
+    GateIndexMap::iterator itr = visited.find(output_gate);
+    if (itr != visited.end()) {
+        *gate_index = itr->second;
+        return true;
     }
 
-    gate.visited = true;
-    
-    if (gate.type == GATE_IN) {
-        gate.depth = 0;
-        return depth;
-    }
+    // Gates being walked and the next of their inputs to visit. A gate is
+    // only pushed if it has not been visited, and is done before anything
+    // else is.
+    std::vector<std::pair<Gate*,size_t> > stack;
+    stack.push_back(std::make_pair(output_gate, 0));
+
+    while (!stack.empty()) {
+        Gate *gate = stack.back().first;
+        size_t next = stack.back().second;
+
+        if (next == 0) {
+            if (gate->type == GATE_IN) {
+                if (gate->input_index >= n_inputs)
+                    return false;
+            }
+            else if (gate->fan_in == 0)
+                return false;
+        }
 
-    if (gate.type == GATE_MULT) {
-        depth++;
-    }
+        if (next < gate->fan_in) {
+            stack.back().second++;
+            Gate *in = gate->in_gates[next];
+            if (visited.find(in) == visited.end())
+                stack.push_back(std::make_pair(in, 0));
+            continue;
+        }
 
-    int fan_in = gate.fan_in;
-    int max_depth = compute_depth_rec(gate.in_gates[0], depth);
-    for (int i = 1; i < fan_in; i++) {
-        int d = compute_depth_rec(gate.in_gates[i], depth);
-        if (d > max_depth)
-            max_depth = d;
+        visited[gate] = order.size();
+        order.push_back(gate);
+        stack.pop_back();
     }
-    gate.depth = max_depth - depth;
 
-    return max_depth;
+    *gate_index = order.size() - 1;
+    return true;
 }
 
-    
-bool Circuit::check_well_formed(std::vector<InternalGate> &gates,
-                                size_t n_inputs,
-                                Gate *current_gate,
-                                std::map<Gate*,unsigned int> &visited,
-                                unsigned int *gate_index)
+/*
+ * Lays the gates out in the parallel arrays, see gate_types in Circuit.h.
+ * Once the offsets of the operands are known, every gate is filled in
+ * independently, with concurrent lookups in index_of.
+ */
+void Circuit::store_gates(const std::vector<Gate*> &order,
+                          const GateIndexMap &index_of)
 {
-    if (visited.find(current_gate) != visited.end()) {
-        *gate_index = visited[current_gate];
-        return true;
+    long n_gates = order.size();
+
+    binary = true;
+    bool has_origins = false;
+    for (long i = 0; i < n_gates; i++) {
+        if (order[i]->origin != NO_ORIGIN)
+            has_origins = true;
+        if (order[i]->type != GATE_IN && order[i]->fan_in != 2)
+            binary = false;
     }
 
-    if (current_gate->type == GATE_IN) {
-        if (current_gate->input_index > n_inputs)
-            return false;
+    // An input gate has its input index as its single operand (and a
+    // padding operand in a binary circuit)
+    std::vector<unsigned int> offsets(n_gates + 1, 0);
+    for (long i = 0; i < n_gates; i++) {
+        const Gate *gate = order[i];
+        unsigned int n = (gate->type == GATE_IN) ? 1 : gate->fan_in;
+        offsets[i + 1] = offsets[i] + (binary ? 2 : n);
     }
-    else if (current_gate->fan_in == 0) 
-        return false;
 
-    bool valid = true;
-    size_t fan_in = current_gate->fan_in;
+    std::vector<uint8_t> types(n_gates);
+    std::vector<unsigned int> edges(offsets[n_gates], 0);
+    std::vector<unsigned int> gate_origins(has_origins ? n_gates : 0);
 
-    InternalGate internal;
+    #pragma omp parallel for schedule(static) if (n_gates > 1)
+    for (long i = 0; i < n_gates; i++) {
+        const Gate *gate = order[i];
 
-    internal.input_index = current_gate->input_index;
-    internal.type = current_gate->type;
-    internal.fan_in = fan_in;
-    if (fan_in > 0)
-        internal.in_gates = new unsigned int[fan_in];
-    else
-        internal.in_gates = NULL;
+        types[i] = gate->type;
+        if (has_origins)
+            gate_origins[i] = gate->origin;
 
-    for (int i = 0; i < fan_in && valid; i++) {
-        unsigned int index;
-        valid = check_well_formed(gates, n_inputs,
-                                  current_gate->in_gates[i], visited,
-                                  &index);
-        if (valid) {
-            internal.in_gates[i] = index;
+        unsigned int *out = &edges[offsets[i]];
+        if (gate->type == GATE_IN) {
+            out[0] = gate->input_index;
+            continue;
         }
+
+        for (size_t j = 0; j < gate->fan_in; j++)
+            out[j] = index_of.find(gate->in_gates[j])->second;
     }
+    if (binary)
+        offsets.clear();
+
+    gate_types.assign(types);
+    operand_offsets.assign(offsets);
+    operands.assign(edges);
+    origins.assign(gate_origins);
+}
+
+
 
 
-    if (valid) {
-        *gate_index = gates.size();
-        visited[current_gate] = *gate_index;
-        gates.push_back(internal);
+CircuitCone::CircuitCone(const Circuit *circuit,
+                         const std::vector<unsigned int> &output_nos)
+{
+    std::unordered_set<unsigned int> seen;
+    std::vector<unsigned int> stack;
+    for (size_t i = 0; i < output_nos.size(); i++) {
+        if (output_nos[i] >= circuit->get_num_outputs())
+            throw "Could not find circuit";
+        unsigned int out = circuit->get_output_gate_index(output_nos[i]);
+        output_gate_indices.push_back(out);
+        if (seen.insert(out).second)
+            stack.push_back(out);
     }
 
-    return valid;
+    while (!stack.empty()) {
+        unsigned int gate = stack.back();
+        stack.pop_back();
+        gates.push_back(gate);
+
+        const unsigned int *in_gates = circuit->get_in_gates(gate);
+        for (size_t j = 0; j < circuit->get_fan_in(gate); j++) {
+            if (seen.insert(in_gates[j]).second)
+                stack.push_back(in_gates[j]);
+        }
+    }
+    std::sort(gates.begin(), gates.end());
+
+    // Every input of a gate comes before it, as in the circuit
+    level_of.assign(gates.size(), 0);
+    unsigned int n_levels = 0;
+    for (size_t k = 0; k < gates.size(); k++) {
+        const unsigned int *in_gates = circuit->get_in_gates(gates[k]);
+        for (size_t j = 0; j < circuit->get_fan_in(gates[k]); j++) {
+            unsigned int in = get_position(in_gates[j]);
+            level_of[k] = std::max(level_of[k], level_of[in] + 1);
+        }
+        n_levels = std::max(n_levels, level_of[k] + 1);
+    }
+
+    // Counting sort of the positions by level
+    level_offsets.assign(n_levels + 1, 0);
+    for (size_t k = 0; k < gates.size(); k++)
+        level_offsets[level_of[k] + 1]++;
+    for (size_t l = 0; l < n_levels; l++)
+        level_offsets[l + 1] += level_offsets[l];
+
+    std::vector<unsigned int> next(level_offsets.begin(),
+                                   level_offsets.end() - 1);
+    level_positions.resize(gates.size());
+    for (size_t k = 0; k < gates.size(); k++)
+        level_positions[next[level_of[k]]++] = k;
 }
 
+CircuitStats::CircuitStats(const Circuit *circuit, const CircuitCone *cone)
+    : n_mult_gates(0), n_add_gates(0), mult_depth(0), n_levels(0)
+{
+    size_t n_gates = circuit->get_num_gates();
+    depth.assign(n_gates, 0);
+    level.assign(n_gates, 0);
+    fan_out.assign(n_gates, 0);
+
+    // Every input of a gate comes before it
+    size_t n_counted = (cone != NULL) ? cone->get_num_gates() : n_gates;
+    for (size_t k = 0; k < n_counted; k++) {
+        size_t i = (cone != NULL) ? cone->get_gate_index(k) : k;
+        const unsigned int *in_gates = circuit->get_in_gates(i);
+        for (size_t j = 0; j < circuit->get_fan_in(i); j++) {
+            unsigned int in = in_gates[j];
+            depth[i] = std::max(depth[i], depth[in]);
+            level[i] = std::max(level[i], level[in] + 1);
+            fan_out[in]++;
+        }
 
+        GateType type = circuit->get_gate_type(i);
+        if (type == GATE_MULT) {
+            depth[i]++;
+            n_mult_gates++;
+        }
+        else if (type == GATE_ADD)
+            n_add_gates++;
 
+        size_t d = depth[i];
+        if (d >= gates_at_depth.size()) {
+            gates_at_depth.resize(d + 1, 0);
+            mults_at_depth.resize(d + 1, 0);
+        }
+        gates_at_depth[d]++;
+        if (type == GATE_MULT)
+            mults_at_depth[d]++;
+        n_levels = std::max(n_levels, (size_t) level[i] + 1);
+    }
+
+    size_t n_outputs = (cone != NULL) ? cone->get_num_outputs() :
+                                        circuit->get_num_outputs();
+    if (n_outputs == 0)
+        return;
+
+    unsigned int gate = (cone != NULL) ? cone->get_output_gate_index(0) :
+                                         circuit->get_output_gate_index(0);
+    for (size_t k = 1; k < n_outputs; k++) {
+        unsigned int out = (cone != NULL) ? cone->get_output_gate_index(k) :
+                                            circuit->get_output_gate_index(k);
+        if (depth[out] > depth[gate])
+            gate = out;
+    }
+    mult_depth = depth[gate];
+
+    // Down the deepest operand, collecting the GATE_MULT
+    critical_path.resize(mult_depth);
+    while (depth[gate] > 0) {
+        if (circuit->get_gate_type(gate) == GATE_MULT)
+            critical_path[depth[gate] - 1] = gate;
+
+        const unsigned int *in_gates = circuit->get_in_gates(gate);
+        unsigned int next = in_gates[0];
+        for (size_t j = 1; j < circuit->get_fan_in(gate); j++) {
+            if (depth[in_gates[j]] > depth[next])
+                next = in_gates[j];
+        }
+        gate = next;
+    }
+}
 
 Gate input_gate(unsigned int index)
 {
@@ -136,6 +411,7 @@ Gate input_gate(unsigned int index)
     g.type = GATE_IN;
     g.input_index = index;
     g.fan_in = 0;
+    g.origin = NO_ORIGIN;
     g.in_gates = NULL;
 
     return g;
@@ -147,6 +423,7 @@ Gate operator_gate(GateType type, Gate *in1, Gate *in2)
 
     g.type = type;
     g.fan_in = 2;
+    g.origin = NO_ORIGIN;
     g.in_gates = new Gate*[2];
     g.in_gates[0] = in1;
     g.in_gates[1] = in2;
@@ -161,6 +438,7 @@ Gate *new_input_gate(unsigned int index)
     g->type = GATE_IN;
     g->input_index = index;
     g->fan_in = 0;
+    g->origin = NO_ORIGIN;
     g->in_gates = NULL;
 
     return g;
@@ -172,6 +450,7 @@ Gate *new_operator_gate(GateType type, Gate *in1, Gate *in2)
 
     g->type = type;
     g->fan_in = 2;
+    g->origin = NO_ORIGIN;
     g->in_gates = new Gate*[2];
     g->in_gates[0] = in1;
     g->in_gates[1] = in2;
@@ -179,16 +458,4 @@ Gate *new_operator_gate(GateType type, Gate *in1, Gate *in2)
     return g;
 }
 
-
-void Circuit::free_gates()
-{
-    // free allocated memory
-    for (int i = 0; i < gates.size(); i++) {
-        if (gates[i].fan_in > 0 && gates[i].in_gates != NULL) {            
-            delete[] gates[i].in_gates;
-            gates[i].in_gates = NULL;
-        }
-    }
-}
-
 }
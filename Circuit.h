@@ -4,8 +4,11 @@
 #include <set>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <cstdlib>
 #include <stdint.h>
+#include <chrono>
+#include <algorithm>
 
 
 
@@ -20,46 +23,380 @@ enum GateType {
     GATE_IN
 };
 
+/*
+ * Strategy used by Circuit::evaluate. ENGINE_RECURSIVE walks the circuit
+ * from the output gate, ENGINE_ITERATIVE runs over the gates in topological
+ * order as a flat loop and ENGINE_LEVELED evaluates the gates of each
+ * dependency level concurrently with OpenMP. ENGINE_DATAFLOW fires each gate
+ * as soon as its inputs are ready (see DataflowExecutor); SCDLProgram::run
+ * accepts it, Circuit itself does not.
+ */
+enum EvalEngine {
+    ENGINE_RECURSIVE,
+    ENGINE_ITERATIVE,
+    ENGINE_LEVELED,
+    ENGINE_DATAFLOW
+};
+
+
+/* Origin of a gate that no SCDL function created, e.g. an input */
+#define NO_ORIGIN ((unsigned int) -1)
 
+/*
+ * origin is the call site (see Provenance.h) whose instantiation created
+ * the gate, or NO_ORIGIN. The optimizer passes it on to the gates it makes
+ * in place of a gate.
+ */
 struct Gate {
     GateType type;
     unsigned int input_index;
-    size_t fan_in;
+    unsigned int fan_in;
+    unsigned int origin;
     Gate **in_gates;
 };
 
-struct InternalGate {
-    GateType type;
-    unsigned int input_index;
-    size_t fan_in;
-    unsigned int *in_gates;
-    bool visited;
-    int depth;
+
+typedef std::set<Gate*> GateSet;
+typedef std::unordered_map<Gate*,unsigned int> GateIndexMap;
+
+/*
+ * Read-only array that either owns its elements or refers to elements
+ * owned elsewhere, e.g. by a mapped program image (see ProgramImage.h).
+ */
+template <class T>
+class ConstArray {
+ public:
+    ConstArray() : elements(NULL), n_elements(0) {}
+
+    /* Takes the contents of v over */
+    void assign(std::vector<T> &v) {
+        owned.swap(v);
+        elements = owned.data();
+        n_elements = owned.size();
+    }
+
+    /* The elements must outlive the array */
+    void refer(const T *data, size_t n) {
+        owned.clear();
+        elements = data;
+        n_elements = n;
+    }
+
+    const T &operator[](size_t i) const {
+        return elements[i];
+    }
+
+    const T *data() const {
+        return elements;
+    }
+
+    size_t size() const {
+        return n_elements;
+    }
+
+    bool empty() const {
+        return n_elements == 0;
+    }
+
+ private:
+    ConstArray(const ConstArray &) = delete;
+    ConstArray &operator=(const ConstArray &) = delete;
+
+    std::vector<T> owned;
+    const T *elements;
+    size_t n_elements;
+};
+
+/*
+ * Everything a built Circuit consists of. Circuits are written to program
+ * images in this form and can be constructed over it without rebuilding.
+ */
+struct CircuitLayout {
+    size_t n_inputs;
+    size_t n_add_gates;
+    size_t n_mult_gates;
+    size_t n_slots;
+    int mult_depth;
+    bool binary;
+    size_t n_gates;
+    size_t n_operands;
+    size_t n_outputs;
+    size_t n_levels;
+    const uint8_t *gate_types;              // n_gates
+    const unsigned int *operand_offsets;    // n_gates + 1, NULL if binary
+    const unsigned int *operands;           // n_operands
+    const unsigned int *output_gate_indices; // n_outputs
+    const unsigned int *level_offsets;      // n_levels + 1
+    const unsigned int *level_gates;        // n_gates
+    const unsigned int *slot_of;            // n_gates
+    const unsigned int *origins;            // n_gates, NULL if unknown
 };
 
+class Circuit;
+class CircuitStats;
 
+/*
+ * Statistics of the evaluations of a Circuit, gathered when an EvalStats is
+ * attached to the EvalContext (or given to SCDLProgram::run). They add up
+ * over evaluations until reset. Without one, the engines run the same code
+ * as if the statistics did not exist.
+ */
+struct EvalStats {
+    EvalStats() {
+        reset();
+    }
 
-typedef std::set<Gate*> GateSet;
+    void reset() {
+        n_evaluations = 0;
+        std::fill(n_gates, n_gates + 4, 0);
+        n_copies = 0;
+        n_constructions = 0;
+        peak_live_values = 0;
+        seconds = 0;
+        level_seconds.clear();
+    }
+
+    size_t n_evaluations;
+    size_t n_gates[4];          // gates executed, indexed by GateType
+    size_t n_copies;            // copies of T made by the engine
+    size_t n_constructions;     // values of T constructed to store results
+    size_t peak_live_values;    // values of T stored at once
+    double seconds;
+
+    /*
+     * Time spent on the gates of each dependency level (see
+     * Circuit::get_num_levels), which is not their multiplicative depth.
+     * The iterative and recursive engines time every gate, the leveled
+     * engine every level.
+     */
+    std::vector<double> level_seconds;
+};
+
+/* The tracer of an evaluation without EvalStats: every call is a no-op */
+struct NullTracer {
+    static constexpr bool enabled = false;
+
+    void on_gate(GateType type, size_t n_copies) {}
+    void on_copies(size_t n) {}
+    void on_storage(size_t n_values, bool constructed) {}
+    void begin_gate() {}
+    void end_gate(unsigned int gate_index, GateType type, size_t n_copies) {}
+    void end_step(unsigned int gate_index) {}
+    void begin_level() {}
+    void end_level(size_t level) {}
+};
+
+/* Records the events of one evaluation into an EvalStats */
+class StatsTracer {
+ public:
+    static constexpr bool enabled = true;
+
+    /* level_of is only needed by end_gate and end_step */
+    StatsTracer(EvalStats &stats, size_t n_levels,
+                const std::vector<unsigned int> *level_of=NULL)
+        : stats(stats), level_of(level_of),
+          start(std::chrono::steady_clock::now()) {
+        if (stats.level_seconds.size() < n_levels)
+            stats.level_seconds.resize(n_levels, 0);
+    }
+
+    void on_gate(GateType type, size_t n_copies) {
+        stats.n_gates[type]++;
+        stats.n_copies += n_copies;
+    }
+
+    void on_copies(size_t n) {
+        stats.n_copies += n;
+    }
+
+    /* The engine stores n_values values, constructed anew or reused */
+    void on_storage(size_t n_values, bool constructed) {
+        stats.peak_live_values = std::max(stats.peak_live_values, n_values);
+        if (constructed)
+            stats.n_constructions += n_values;
+    }
+
+    void begin_gate() {
+        step_start = std::chrono::steady_clock::now();
+    }
+
+    void end_gate(unsigned int gate_index, GateType type, size_t n_copies) {
+        on_gate(type, n_copies);
+        end_step(gate_index);
+    }
+
+    /*
+     * Adds the time since begin_gate to the level of a gate without
+     * counting the gate, for engines that compute a gate in several steps
+     */
+    void end_step(unsigned int gate_index) {
+        stats.level_seconds[(*level_of)[gate_index]] += elapsed(step_start);
+    }
+
+    void begin_level() {
+        step_start = std::chrono::steady_clock::now();
+    }
+
+    void end_level(size_t level) {
+        stats.level_seconds[level] += elapsed(step_start);
+    }
+
+    void finish() {
+        stats.n_evaluations++;
+        stats.seconds += elapsed(start);
+    }
+
+ private:
+    static double elapsed(std::chrono::steady_clock::time_point since) {
+        std::chrono::duration<double> d =
+            std::chrono::steady_clock::now() - since;
+        return d.count();
+    }
+
+    EvalStats &stats;
+    const std::vector<unsigned int> *level_of;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point step_start;
+};
+
+/*
+ * Per-evaluation state of a Circuit: the stored values (one per value slot
+ * or, for the leveled engine and the recursive one over a cone, one per
+ * gate) and which gates have been
+ * visited by the recursive engine. Keeping it out of
+ * the Circuit lets any number of threads evaluate one Circuit at once,
+ * each with its own context. A context may be reused across evaluations
+ * to avoid reallocating its storage; visited marks are invalidated by
+ * bumping an epoch counter instead of clearing them.
+ */
+template <class T>
+class EvalContext {
+ public:
+    EvalContext() : epoch(0), stats(NULL) {}
+
+    /* Evaluations with this context add to stats, if not NULL */
+    void set_stats(EvalStats *stats) {
+        this->stats = stats;
+    }
+
+    EvalStats *get_stats() const {
+        return stats;
+    }
+
+ private:
+    friend class Circuit;
+
+    void begin(size_t n_gates, size_t n_values, const T &fill) {
+        if (values.size() != n_values)
+            values.assign(n_values, fill);
+        if (visit_epoch.size() != n_gates) {
+            visit_epoch.assign(n_gates, 0);
+            epoch = 0;
+        }
+        if (++epoch == 0) {
+            // The counter wrapped around, so old marks could look current
+            visit_epoch.assign(n_gates, 0);
+            epoch = 1;
+        }
+    }
+
+    bool is_visited(unsigned int gate_index) const {
+        return visit_epoch[gate_index] == epoch;
+    }
+
+    void set_visited(unsigned int gate_index) {
+        visit_epoch[gate_index] = epoch;
+    }
+
+    std::vector<T> values;
+    std::vector<unsigned int> visit_epoch;
+    unsigned int epoch;
+    EvalStats *stats;
+};
+
+/*
+ * Some of the outputs of a circuit and the gates they depend on, given by
+ * their indices in the circuit, in its order. A cone lets outputs of a
+ * large circuit, such as the gate pool of a program, be evaluated on the
+ * circuit itself (see Circuit::evaluate_cone): nothing of the circuit is
+ * copied, a cone only lists gates. Computing one costs the size of the
+ * cone, not that of the circuit.
+ */
+class CircuitCone {
+ public:
+    CircuitCone() {}
+
+    /* The gates the given outputs of circuit depend on */
+    CircuitCone(const Circuit *circuit,
+                const std::vector<unsigned int> &output_nos);
+
+    size_t get_num_gates() const {
+        return gates.size();
+    }
+
+    /* Index in the circuit of the gate at position k of the cone */
+    unsigned int get_gate_index(size_t k) const {
+        return gates[k];
+    }
+
+    /* Position in the cone of one of its gates */
+    unsigned int get_position(unsigned int gate_index) const {
+        return std::lower_bound(gates.begin(), gates.end(), gate_index)
+               - gates.begin();
+    }
+
+    size_t get_num_outputs() const {
+        return output_gate_indices.size();
+    }
+
+    unsigned int get_output_gate_index(unsigned int output_no) const {
+        return output_gate_indices[output_no];
+    }
+
+    /* The levels of the circuit that have gates of the cone */
+    size_t get_num_levels() const {
+        return level_offsets.empty() ? 0 : level_offsets.size() - 1;
+    }
+
+ private:
+    friend class Circuit;
+
+    std::vector<unsigned int> output_gate_indices;
+    std::vector<unsigned int> gates;
+    // Dependency level of the gate at each position (see
+    // Circuit::get_num_levels), and the positions grouped by level as in
+    // Circuit::level_gates
+    std::vector<unsigned int> level_of;
+    std::vector<unsigned int> level_offsets;
+    std::vector<unsigned int> level_positions;
+};
 
 class Circuit {
 public:
-    Circuit() {n_inputs = 0;}
+    Circuit() {n_inputs = 0; n_slots = 0; binary = true;}
 
     Circuit(size_t n_inputs, Gate *output_gate)
         : n_inputs(n_inputs), mult_depth(0) {
-        std::map<Gate*,unsigned int> visited;
-        if (!check_well_formed(gates, n_inputs, output_gate, visited,
-                               &output_gate_index)) {
-            free_gates();
-            throw "Circuit not well formed";
-        }
-        mult_depth = compute_depth();
-        count_gates();
+        build(std::vector<Gate*>(1, output_gate));
     }
-    ~Circuit() {
-        free_gates();
+
+    /*
+     * Circuit with several output gates over one shared DAG: a gate that
+     * feeds more than one output is only stored (and evaluated) once.
+     */
+    Circuit(size_t n_inputs, const std::vector<Gate*> &output_gates)
+        : n_inputs(n_inputs), mult_depth(0) {
+        build(output_gates);
     }
 
+    /*
+     * Circuit over the arrays of a layout, which must outlive it. Nothing
+     * is copied or checked, so this costs the same for any circuit size.
+     */
+    Circuit(const CircuitLayout &layout);
+
+    CircuitLayout get_layout() const;
+
     size_t get_num_inputs() const {
         return n_inputs;
     }
@@ -76,104 +413,745 @@ public:
         return n_mult_gates;
     }
 
+    size_t get_num_gates() const {
+        return gate_types.size();
+    }
+
+    GateType get_gate_type(unsigned int gate_index) const {
+        return (GateType) gate_types[gate_index];
+    }
+
+    size_t get_fan_in(unsigned int gate_index) const {
+        if (gate_types[gate_index] == GATE_IN)
+            return 0;
+        if (binary)
+            return 2;
+        return operand_offsets[gate_index + 1] - operand_offsets[gate_index];
+    }
+
+    /* Indices of the input gates of an operator gate */
+    const unsigned int *get_in_gates(unsigned int gate_index) const {
+        return &operands[first_operand(gate_index)];
+    }
+
+    unsigned int get_input_index(unsigned int gate_index) const {
+        return operands[first_operand(gate_index)];
+    }
+
+    /* True if every operator gate has two inputs (see first_operand) */
+    bool has_binary_gates() const {
+        return binary;
+    }
+
+    unsigned int get_output_gate_index() const {
+        return output_gate_index;
+    }
+
+    size_t get_num_outputs() const {
+        return output_gate_indices.size();
+    }
+
+    unsigned int get_output_gate_index(unsigned int output_no) const {
+        return output_gate_indices[output_no];
+    }
+
+    /*
+     * Gates are grouped by dependency level: inputs are on level 0 and an
+     * operator gate is one level above its deepest input gate.
+     */
+    size_t get_num_levels() const {
+        return level_offsets.empty() ? 0 : level_offsets.size() - 1;
+    }
+
+    /*
+     * Peak number of gate values that are live at once when the gates are
+     * evaluated in order. The recursive (with store) and iterative engines
+     * keep only this many values of type T.
+     */
+    size_t get_num_slots() const {
+        return n_slots;
+    }
+
+    unsigned int get_slot(unsigned int gate_index) const {
+        return slot_of[gate_index];
+    }
+
+    /* False if no gate has an origin, e.g. in an image without them */
+    bool has_origins() const {
+        return !origins.empty();
+    }
+
+    /* Call site that created a gate (see Gate), or NO_ORIGIN */
+    unsigned int get_origin(unsigned int gate_index) const {
+        return origins.empty() ? NO_ORIGIN : origins[gate_index];
+    }
+
     template <class T>
-    T evaluate(const T *inputs, bool store=false) {
-        for (int i = 0; i < gates.size(); i++)
-            gates[i].visited = false;
+    T evaluate(const T *inputs, bool store=false,
+               EvalEngine engine=ENGINE_RECURSIVE,
+               EvalStats *stats=NULL) const {
+        EvalContext<T> context;
+        context.set_stats(stats);
+        return evaluate(context, inputs, store, engine);
+    }
 
-        if (store) {
-            // The line below does not work because T may not have a default
-            // constructor so we have to do it a different way
-            // std::vector<T> stored(gates.size());
-            std::vector<T> stored;
-            for (int i = 0; i < gates.size(); i++)
-                stored.push_back(inputs[0]);
-            return eval_gate_with_store(output_gate_index, inputs, &stored[0]);
+    template <class T>
+    T evaluate(EvalContext<T> &context, const T *inputs, bool store=false,
+               EvalEngine engine=ENGINE_RECURSIVE) const {
+        if (context.stats == NULL) {
+            NullTracer tracer;
+            return run_engine(context, inputs, store, engine, tracer);
         }
-        else
-            return eval_gate_no_store(output_gate_index, inputs);
+
+        std::vector<unsigned int> level_of;
+        if (engine != ENGINE_LEVELED)
+            get_gate_levels(level_of);
+        StatsTracer tracer(*context.stats, get_num_levels(), &level_of);
+        T value = run_engine(context, inputs, store, engine, tracer);
+        tracer.finish();
+        return value;
+    }
+
+    /*
+     * Evaluates every output gate in a single pass, so gates shared
+     * between outputs are computed once. outputs[i] is the value of output
+     * i in the order the output gates were given at construction.
+     */
+    template <class T>
+    void evaluate_all(const T *inputs, std::vector<T> &outputs,
+                      EvalEngine engine=ENGINE_RECURSIVE,
+                      EvalStats *stats=NULL) const {
+        EvalContext<T> context;
+        context.set_stats(stats);
+        evaluate_all(context, inputs, outputs, engine);
     }
 
+    template <class T>
+    void evaluate_all(EvalContext<T> &context, const T *inputs,
+                      std::vector<T> &outputs,
+                      EvalEngine engine=ENGINE_RECURSIVE) const {
+        if (context.stats == NULL) {
+            NullTracer tracer;
+            run_engine_all(context, inputs, outputs, engine, tracer);
+            return;
+        }
+
+        std::vector<unsigned int> level_of;
+        if (engine != ENGINE_LEVELED)
+            get_gate_levels(level_of);
+        StatsTracer tracer(*context.stats, get_num_levels(), &level_of);
+        run_engine_all(context, inputs, outputs, engine, tracer);
+        tracer.finish();
+    }
 
+    /*
+     * Evaluates the outputs of a cone of this circuit in a single pass over
+     * the gates of the cone. outputs[i] is the value of output i of the
+     * cone.
+     */
+    template <class T>
+    void evaluate_cone(const CircuitCone &cone, const T *inputs,
+                       std::vector<T> &outputs,
+                       EvalEngine engine=ENGINE_RECURSIVE,
+                       EvalStats *stats=NULL) const {
+        EvalContext<T> context;
+        context.set_stats(stats);
+        evaluate_cone(context, cone, inputs, outputs, engine);
+    }
 
     template <class T>
+    void evaluate_cone(EvalContext<T> &context, const CircuitCone &cone,
+                       const T *inputs, std::vector<T> &outputs,
+                       EvalEngine engine=ENGINE_RECURSIVE) const {
+        if (context.stats == NULL) {
+            NullTracer tracer;
+            run_engine_cone(context, cone, inputs, outputs, engine, tracer);
+            return;
+        }
+
+        // The iterative and recursive engines time gates by cone position
+        StatsTracer tracer(*context.stats, cone.get_num_levels(),
+                           &cone.level_of);
+        run_engine_cone(context, cone, inputs, outputs, engine, tracer);
+        tracer.finish();
+    }
+
+    /* The dependency level of every gate (see get_num_levels) */
+    void get_gate_levels(std::vector<unsigned int> &level_of) const {
+        level_of.resize(get_num_gates());
+        for (size_t l = 0; l < get_num_levels(); l++) {
+            for (unsigned int k = level_offsets[l]; k < level_offsets[l + 1];
+                 k++)
+                level_of[level_gates[k]] = l;
+        }
+    }
+
+    /*
+     * Stored values are kept in the slots assigned by allocate_slots. The
+     * recursion completes gates in the same post-order as the stored gates,
+     * so a slot is only reused once every consumer of its gate is done.
+     */
+    template <class T, class Tracer>
     T eval_gate_with_store(unsigned int gate_index, const T *inputs,
-                           T *stored) {
-            InternalGate &gate = gates[gate_index];
-            if (gate.visited) {
-                return stored[gate_index];
-            }
+                           EvalContext<T> &context, Tracer &tracer) const {
+        SlotIndex index = {slot_of.data()};
+        return eval_gate_stored(gate_index, inputs, context, tracer, index);
+    }
 
-            if (gate.type == GATE_IN) {
-                T value = inputs[gate.input_index];
-                stored[gate_index] = value;
-                gate.visited = true;
+    template <class T, class Tracer> 
+        T eval_gate_no_store(unsigned int gate_index, const T *inputs,
+                             Tracer &tracer) const
+    {
+            GateType type = get_gate_type(gate_index);
+            const unsigned int *in_gates = get_in_gates(gate_index);
+
+            if (type == GATE_IN) {
+                tracer.begin_gate();
+                T value = inputs[in_gates[0]];
+                tracer.end_gate(gate_index, type, 1);
                 return value;
             }
 
-            int fan_in = gate.fan_in;
-            T aggr = eval_gate_with_store(gate.in_gates[0], inputs, stored);
+            int fan_in = get_fan_in(gate_index);
+
+            // Only the operations are timed, not the operands they wait for
+            T aggr = eval_gate_no_store(in_gates[0], inputs, tracer);
             for (int i = 1; i < fan_in; i++) {
-                T v = eval_gate_with_store(gate.in_gates[i], inputs, stored);
-                if (gate.type == GATE_MULT) {
+                T v = eval_gate_no_store(in_gates[i], inputs, tracer);
+                tracer.begin_gate();
+                if (type == GATE_MULT)
                     aggr *= v;
-                }
-                else if (gate.type == GATE_ADD)
+                else if (type == GATE_ADD)
                     aggr += v;
+                tracer.end_step(gate_index);
             }
-            stored[gate_index] = aggr;
-            gate.visited = true;
-            
+            tracer.on_gate(type, 0);
+
             return aggr;
         }
 
-    template <class T> 
-        T eval_gate_no_store(unsigned int gate_index, const T *inputs)
-    {
-            InternalGate &gate = gates[gate_index];
+    template <class T>
+    void eval_iterative(const T *inputs, std::vector<T> &values) const {
+        NullTracer tracer;
+        eval_iterative(inputs, values, tracer);
+    }
 
-            if (gate.type == GATE_IN) {
-                T value = inputs[gate.input_index];
-                gate.visited = true;
-                return value;
+    /*
+     * The gates are stored in the post-order of check_well_formed, so they
+     * are already a topological order with every gate after its inputs. The
+     * loop runs over them and keeps each value in the slot given to its gate
+     * by allocate_slots, so only get_num_slots() values are ever live.
+     */
+    template <class T, class Tracer>
+    void eval_iterative(const T *inputs, std::vector<T> &values,
+                        Tracer &tracer) const {
+        // T may not have a default constructor
+        bool constructed = values.size() != n_slots;
+        if (constructed)
+            values.assign(n_slots, inputs[0]);
+        tracer.on_storage(n_slots, constructed);
+
+        size_t n_gates = get_num_gates();
+        if (binary) {
+            // Fixed-width operands: a linear scan over the two arrays
+            for (size_t i = 0; i < n_gates; i++) {
+                const unsigned int *in = &operands[2 * i];
+                tracer.begin_gate();
+
+                // The gate may share its slot with an operand whose last
+                // use it is, so the result is only written back once
+                // complete
+                if (gate_types[i] == GATE_IN) {
+                    values[slot_of[i]] = inputs[in[0]];
+                }
+                else if (gate_types[i] == GATE_MULT) {
+                    T aggr = values[slot_of[in[0]]];
+                    aggr *= values[slot_of[in[1]]];
+                    values[slot_of[i]] = aggr;
+                }
+                else if (gate_types[i] == GATE_ADD) {
+                    T aggr = values[slot_of[in[0]]];
+                    aggr += values[slot_of[in[1]]];
+                    values[slot_of[i]] = aggr;
+                }
+                else {
+                    T aggr = values[slot_of[in[0]]];
+                    values[slot_of[i]] = aggr;
+                }
+                tracer.end_gate(i, (GateType) gate_types[i],
+                                (gate_types[i] == GATE_IN) ? 1 : 2);
             }
+            return;
+        }
 
-            int fan_in = gate.fan_in;
+        for (size_t i = 0; i < n_gates; i++) {
+            GateType type = get_gate_type(i);
+            const unsigned int *in_gates = get_in_gates(i);
+            tracer.begin_gate();
 
-            T aggr = eval_gate_no_store(gate.in_gates[0], inputs);
-            for (int i = 1; i < fan_in; i++) {
-                T v = eval_gate_no_store(gate.in_gates[i], inputs);
-                if (gate.type == GATE_MULT)
-                    aggr *= v;
-                else if (gate.type == GATE_ADD)
-                    aggr += v;
+            if (type == GATE_IN) {
+                values[slot_of[i]] = inputs[in_gates[0]];
+                tracer.end_gate(i, type, 1);
+                continue;
             }
 
-            gate.visited = true;
-            return aggr;
+            T aggr = values[slot_of[in_gates[0]]];
+            size_t fan_in = get_fan_in(i);
+            for (size_t j = 1; j < fan_in; j++) {
+                if (type == GATE_MULT)
+                    aggr *= values[slot_of[in_gates[j]]];
+                else if (type == GATE_ADD)
+                    aggr += values[slot_of[in_gates[j]]];
+            }
+            values[slot_of[i]] = aggr;
+            tracer.end_gate(i, type, 2);
+        }
+    }
+
+    /*
+     * eval_iterative over the gates of a cone only, in the order of the
+     * circuit. Each gate keeps the slot allocate_slots gave it in the whole
+     * circuit: as no other gate is evaluated, a slot still only changes
+     * hands once every consumer of its gate is done. end_gate is given the
+     * position of the gate in the cone.
+     */
+    template <class T, class Tracer>
+    void eval_iterative_cone(const CircuitCone &cone, const T *inputs,
+                             std::vector<T> &values, Tracer &tracer) const {
+        // T may not have a default constructor
+        bool constructed = values.size() != n_slots;
+        if (constructed)
+            values.assign(n_slots, inputs[0]);
+        tracer.on_storage(n_slots, constructed);
+
+        for (size_t k = 0; k < cone.get_num_gates(); k++) {
+            unsigned int i = cone.get_gate_index(k);
+            GateType type = get_gate_type(i);
+            const unsigned int *in_gates = get_in_gates(i);
+            tracer.begin_gate();
+
+            if (type == GATE_IN) {
+                values[slot_of[i]] = inputs[in_gates[0]];
+                tracer.end_gate(k, type, 1);
+                continue;
+            }
+
+            T aggr = values[slot_of[in_gates[0]]];
+            size_t fan_in = get_fan_in(i);
+            for (size_t j = 1; j < fan_in; j++) {
+                if (type == GATE_MULT)
+                    aggr *= values[slot_of[in_gates[j]]];
+                else if (type == GATE_ADD)
+                    aggr += values[slot_of[in_gates[j]]];
+            }
+            values[slot_of[i]] = aggr;
+            tracer.end_gate(k, type, 2);
+        }
+    }
+
+    template <class T>
+    void eval_leveled(const T *inputs, std::vector<T> &values) const {
+        NullTracer tracer;
+        eval_leveled(inputs, values, tracer);
+    }
+
+    /*
+     * Gates on the same level do not depend on each other, so each level is
+     * evaluated as a parallel loop with an implicit barrier at its end.
+     * This pays off when T is expensive, e.g. a ciphertext.
+     */
+    template <class T, class Tracer>
+    void eval_leveled(const T *inputs, std::vector<T> &values,
+                      Tracer &tracer) const {
+        // Every slot is overwritten below, so a reused vector of the right
+        // size needs no refill. T may not have a default constructor.
+        bool constructed = values.size() != get_num_gates();
+        if (constructed)
+            values.assign(get_num_gates(), inputs[0]);
+        tracer.on_storage(get_num_gates(), constructed);
+
+        for (size_t l = 0; l < get_num_levels(); l++) {
+            long begin = level_offsets[l];
+            long end = level_offsets[l + 1];
+
+            // Counted outside of the parallel loop, which the tracer is not
+            // safe to be called from
+            if (Tracer::enabled) {
+                for (long k = begin; k < end; k++) {
+                    GateType type = get_gate_type(level_gates[k]);
+                    tracer.on_gate(type, (type == GATE_IN) ? 1 : 2);
+                }
+            }
+            tracer.begin_level();
+
+            #pragma omp parallel for schedule(dynamic) if (end - begin > 1)
+            for (long k = begin; k < end; k++) {
+                unsigned int gate_index = level_gates[k];
+                GateType type = get_gate_type(gate_index);
+                const unsigned int *in_gates = get_in_gates(gate_index);
+
+                if (type == GATE_IN) {
+                    values[gate_index] = inputs[in_gates[0]];
+                    continue;
+                }
+
+                T aggr = values[in_gates[0]];
+                if (binary) {
+                    if (type == GATE_MULT)
+                        aggr *= values[in_gates[1]];
+                    else if (type == GATE_ADD)
+                        aggr += values[in_gates[1]];
+                    values[gate_index] = aggr;
+                    continue;
+                }
+
+                size_t fan_in = get_fan_in(gate_index);
+                for (size_t j = 1; j < fan_in; j++) {
+                    if (type == GATE_MULT)
+                        aggr *= values[in_gates[j]];
+                    else if (type == GATE_ADD)
+                        aggr += values[in_gates[j]];
+                }
+                values[gate_index] = aggr;
+            }
+            tracer.end_level(l);
         }
+    }
+
+    /*
+     * eval_leveled over the levels of a cone, with one value per gate of
+     * the cone at its position
+     */
+    template <class T, class Tracer>
+    void eval_leveled_cone(const CircuitCone &cone, const T *inputs,
+                           std::vector<T> &values, Tracer &tracer) const {
+        size_t n_gates = cone.get_num_gates();
+        bool constructed = values.size() != n_gates;
+        if (constructed)
+            values.assign(n_gates, inputs[0]);
+        tracer.on_storage(n_gates, constructed);
+
+        for (size_t l = 0; l < cone.get_num_levels(); l++) {
+            long begin = cone.level_offsets[l];
+            long end = cone.level_offsets[l + 1];
+
+            if (Tracer::enabled) {
+                for (long k = begin; k < end; k++) {
+                    unsigned int p = cone.level_positions[k];
+                    GateType type = get_gate_type(cone.gates[p]);
+                    tracer.on_gate(type, (type == GATE_IN) ? 1 : 2);
+                }
+            }
+            tracer.begin_level();
+
+            #pragma omp parallel for schedule(dynamic) if (end - begin > 1)
+            for (long k = begin; k < end; k++) {
+                unsigned int p = cone.level_positions[k];
+                unsigned int gate_index = cone.gates[p];
+                GateType type = get_gate_type(gate_index);
+                const unsigned int *in_gates = get_in_gates(gate_index);
 
+                if (type == GATE_IN) {
+                    values[p] = inputs[in_gates[0]];
+                    continue;
+                }
+
+                T aggr = values[cone.get_position(in_gates[0])];
+                size_t fan_in = get_fan_in(gate_index);
+                for (size_t j = 1; j < fan_in; j++) {
+                    unsigned int in = cone.get_position(in_gates[j]);
+                    if (type == GATE_MULT)
+                        aggr *= values[in];
+                    else if (type == GATE_ADD)
+                        aggr += values[in];
+                }
+                values[p] = aggr;
+            }
+            tracer.end_level(l);
+        }
+    }
 
  private:
+    /* Where eval_gate_with_store keeps the mark and value of a gate */
+    struct SlotIndex {
+        const unsigned int *slot_of;
+
+        void locate(unsigned int gate_index, unsigned int *mark,
+                    unsigned int *value_index) const {
+            *mark = gate_index;
+            *value_index = slot_of[gate_index];
+        }
+    };
+
+    /*
+     * The recursion does not complete the gates of a cone in the order the
+     * slots were allocated in, so over a cone a gate keeps its mark and
+     * value at its position in the cone instead
+     */
+    struct ConeIndex {
+        const CircuitCone *cone;
+
+        void locate(unsigned int gate_index, unsigned int *mark,
+                    unsigned int *value_index) const {
+            *mark = *value_index = cone->get_position(gate_index);
+        }
+    };
+
+    template <class T, class Tracer, class Index>
+    T eval_gate_stored(unsigned int gate_index, const T *inputs,
+                       EvalContext<T> &context, Tracer &tracer,
+                       const Index &index) const {
+        // The tracer looks the level of a gate up by its mark
+        unsigned int mark, value_index;
+        index.locate(gate_index, &mark, &value_index);
+        if (context.is_visited(mark)) {
+            tracer.on_copies(1);
+            return context.values[value_index];
+        }
+
+        GateType type = get_gate_type(gate_index);
+        const unsigned int *in_gates = get_in_gates(gate_index);
+        if (type == GATE_IN) {
+            tracer.begin_gate();
+            T value = inputs[in_gates[0]];
+            context.values[value_index] = value;
+            context.set_visited(mark);
+            tracer.end_gate(mark, type, 2);
+            return value;
+        }
+
+        // Only the operations are timed, not the operands they wait for
+        int fan_in = get_fan_in(gate_index);
+        T aggr = eval_gate_stored(in_gates[0], inputs, context, tracer,
+                                  index);
+        for (int i = 1; i < fan_in; i++) {
+            T v = eval_gate_stored(in_gates[i], inputs, context, tracer,
+                                   index);
+            tracer.begin_gate();
+            if (type == GATE_MULT) {
+                aggr *= v;
+            }
+            else if (type == GATE_ADD)
+                aggr += v;
+            tracer.end_step(mark);
+        }
+        tracer.begin_gate();
+        context.values[value_index] = aggr;
+        context.set_visited(mark);
+        tracer.end_gate(mark, type, 1);
+
+        return aggr;
+    }
+
+    template <class T, class Tracer>
+    T run_engine(EvalContext<T> &context, const T *inputs, bool store,
+                 EvalEngine engine, Tracer &tracer) const {
+        if (engine == ENGINE_DATAFLOW)
+            throw "Dataflow evaluation needs a DataflowExecutor";
+        if (engine == ENGINE_ITERATIVE) {
+            eval_iterative(inputs, context.values, tracer);
+            tracer.on_copies(1);
+            return context.values[slot_of[output_gate_index]];
+        }
+        else if (engine == ENGINE_LEVELED) {
+            eval_leveled(inputs, context.values, tracer);
+            tracer.on_copies(1);
+            return context.values[output_gate_index];
+        }
+
+        if (store) {
+            bool constructed = context.values.size() != n_slots;
+            context.begin(get_num_gates(), n_slots, inputs[0]);
+            tracer.on_storage(n_slots, constructed);
+            return eval_gate_with_store(output_gate_index, inputs, context,
+                                        tracer);
+        }
+        else
+            return eval_gate_no_store(output_gate_index, inputs, tracer);
+    }
+
+    template <class T, class Tracer>
+    void run_engine_all(EvalContext<T> &context, const T *inputs,
+                        std::vector<T> &outputs, EvalEngine engine,
+                        Tracer &tracer) const {
+        if (engine == ENGINE_DATAFLOW)
+            throw "Dataflow evaluation needs a DataflowExecutor";
+        outputs.clear();
+        tracer.on_copies(output_gate_indices.size());
+
+        if (engine == ENGINE_ITERATIVE) {
+            eval_iterative(inputs, context.values, tracer);
+            for (size_t i = 0; i < output_gate_indices.size(); i++) {
+                unsigned int slot = slot_of[output_gate_indices[i]];
+                outputs.push_back(context.values[slot]);
+            }
+            return;
+        }
+        else if (engine == ENGINE_LEVELED) {
+            eval_leveled(inputs, context.values, tracer);
+            for (size_t i = 0; i < output_gate_indices.size(); i++)
+                outputs.push_back(context.values[output_gate_indices[i]]);
+            return;
+        }
+
+        bool constructed = context.values.size() != n_slots;
+        context.begin(get_num_gates(), n_slots, inputs[0]);
+        tracer.on_storage(n_slots, constructed);
+        for (size_t i = 0; i < output_gate_indices.size(); i++)
+            outputs.push_back(eval_gate_with_store(output_gate_indices[i],
+                                                   inputs, context, tracer));
+    }
+
+    template <class T, class Tracer>
+    void run_engine_cone(EvalContext<T> &context, const CircuitCone &cone,
+                         const T *inputs, std::vector<T> &outputs,
+                         EvalEngine engine, Tracer &tracer) const {
+        if (engine == ENGINE_DATAFLOW)
+            throw "Dataflow evaluation needs a DataflowExecutor";
+        outputs.clear();
+        tracer.on_copies(cone.get_num_outputs());
+
+        if (engine == ENGINE_ITERATIVE) {
+            eval_iterative_cone(cone, inputs, context.values, tracer);
+            for (size_t i = 0; i < cone.get_num_outputs(); i++) {
+                unsigned int slot = slot_of[cone.get_output_gate_index(i)];
+                outputs.push_back(context.values[slot]);
+            }
+            return;
+        }
+        else if (engine == ENGINE_LEVELED) {
+            eval_leveled_cone(cone, inputs, context.values, tracer);
+            for (size_t i = 0; i < cone.get_num_outputs(); i++) {
+                unsigned int p =
+                    cone.get_position(cone.get_output_gate_index(i));
+                outputs.push_back(context.values[p]);
+            }
+            return;
+        }
+
+        size_t n_gates = cone.get_num_gates();
+        bool constructed = context.values.size() != n_gates;
+        context.begin(n_gates, n_gates, inputs[0]);
+        tracer.on_storage(n_gates, constructed);
+        ConeIndex index = {&cone};
+        for (size_t i = 0; i < cone.get_num_outputs(); i++)
+            outputs.push_back(eval_gate_stored(cone.get_output_gate_index(i),
+                                               inputs, context, tracer,
+                                               index));
+    }
+
+    /* Position of the first operand of a gate in the operands array */
+    size_t first_operand(unsigned int gate_index) const {
+        return binary ? 2 * (size_t) gate_index : operand_offsets[gate_index];
+    }
+
     unsigned int output_gate_index;
-    std::vector<InternalGate> gates;
+    ConstArray<unsigned int> output_gate_indices;
+
+    /*
+     * The gates as parallel arrays: a byte of GateType per gate and the
+     * indices of their input gates in one contiguous edge array. When every
+     * operator gate has two inputs, which is all the compiler builds, gate
+     * i owns operands[2i] and operands[2i + 1]; otherwise it owns
+     * operands[operand_offsets[i]] up to operands[operand_offsets[i + 1]]
+     * (CSR). The only operand of an input gate is its input index.
+     */
+    ConstArray<uint8_t> gate_types;
+    ConstArray<unsigned int> operand_offsets;
+    ConstArray<unsigned int> operands;
+    bool binary;
     size_t n_inputs;
     size_t n_add_gates;
     size_t n_mult_gates;
     int mult_depth;
+    ConstArray<unsigned int> level_offsets;
+    ConstArray<unsigned int> level_gates;
+    ConstArray<unsigned int> slot_of;
+    ConstArray<unsigned int> origins;
+    size_t n_slots;
+
+    void compute_levels(const CircuitStats &stats);
+    void allocate_slots();
+    void analyze();
+    void build(const std::vector<Gate*> &output_gates);
+    void store_gates(const std::vector<Gate*> &order,
+                     const GateIndexMap &index_of);
+
+    bool check_well_formed(std::vector<Gate*> &order, Gate *output_gate,
+                           GateIndexMap &visited, unsigned int *gate_index);
+};
+
+/*
+ * Structure of a circuit, computed in one pass over its gates in
+ * topological order. The depth of a gate is the number of GATE_MULT on the
+ * longest path from an input to the gate, the gate included, so that the
+ * multiplicative depth of the circuit is the largest depth of its outputs.
+ * Given a cone of the circuit, only the gates and outputs of the cone are
+ * counted; the per-gate values remain indexed by gate index.
+ */
+class CircuitStats {
+ public:
+    CircuitStats(const Circuit *circuit, const CircuitCone *cone=NULL);
+
+    size_t get_num_mult_gates() const {
+        return n_mult_gates;
+    }
+
+    size_t get_num_add_gates() const {
+        return n_add_gates;
+    }
+
+    int get_mult_depth() const {
+        return mult_depth;
+    }
+
+    /* See Circuit::get_num_levels */
+    size_t get_num_levels() const {
+        return n_levels;
+    }
+
+    int get_depth(unsigned int gate_index) const {
+        return depth[gate_index];
+    }
+
+    unsigned int get_level(unsigned int gate_index) const {
+        return level[gate_index];
+    }
+
+    /* Number of operands that refer to the gate; outputs are not counted */
+    unsigned int get_fan_out(unsigned int gate_index) const {
+        return fan_out[gate_index];
+    }
 
-    int compute_depth();
-    int compute_depth_rec(unsigned int gate_index, int depth);
-    void count_gates();
-    void count_gates_rec(unsigned int gate_index);
+    /* Element d is the number of gates of depth d, up to the mult depth */
+    const std::vector<size_t> &get_depth_histogram() const {
+        return gates_at_depth;
+    }
 
-    bool check_well_formed(std::vector<InternalGate> &gates, size_t n_inputs,
-                           Gate *current_gate, std::map<Gate*,unsigned int> &visited,
-                           unsigned int *gate_index);
-    
-    void free_gates();
+    /* Element d is the number of GATE_MULT of depth d */
+    const std::vector<size_t> &get_mult_histogram() const {
+        return mults_at_depth;
+    }
+
+    /*
+     * The GATE_MULT on a path of mult depth length to the deepest output,
+     * from the one nearest the inputs
+     */
+    const std::vector<unsigned int> &get_critical_path() const {
+        return critical_path;
+    }
 
-    
+ private:
+    size_t n_mult_gates;
+    size_t n_add_gates;
+    int mult_depth;
+    size_t n_levels;
+    std::vector<int> depth;
+    std::vector<unsigned int> level;
+    std::vector<unsigned int> fan_out;
+    std::vector<size_t> gates_at_depth;
+    std::vector<size_t> mults_at_depth;
+    std::vector<unsigned int> critical_path;
 };
 
 Gate input_gate(unsigned int index);
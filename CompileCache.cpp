@@ -0,0 +1,192 @@
+#include "CompileCache.h"
+#include "ProgramImage.h"
+#include "Lexer.h"
+
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <algorithm>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace scdl {
+
+/* 64-bit FNV-1a */
+class SourceHash {
+ public:
+    SourceHash() : h(14695981039346656037ULL) {}
+
+    void add(const void *data, size_t n) {
+        const unsigned char *p = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < n; i++) {
+            h ^= p[i];
+            h *= 1099511628211ULL;
+        }
+    }
+
+    void add_int(uint64_t value) {
+        add(&value, sizeof(value));
+    }
+
+    // Length first, so that different splits of the same bytes differ
+    void add_string(const std::string &s) {
+        add_int(s.size());
+        add(s.data(), s.size());
+    }
+
+    uint64_t get() const {
+        return h;
+    }
+
+ private:
+    uint64_t h;
+};
+
+static bool read_file(const std::string &file_name, std::string &contents)
+{
+    std::ifstream in(file_name.c_str(), std::ios::binary);
+    if (!in.good())
+        return false;
+
+    contents.assign(std::istreambuf_iterator<char>(in),
+                    std::istreambuf_iterator<char>());
+    return true;
+}
+
+/*
+ * Adds source to the hash, then each file it includes in the order the
+ * compiler reads them. path holds the files being included, to catch
+ * include cycles that would otherwise never end.
+ */
+static void hash_source_rec(const std::string &source, SourceHash &hash,
+                            std::vector<std::string> &path)
+{
+    using namespace compiler;
+
+    hash.add_string(source);
+
+    Lexer lexer(source);
+    bool statement_start = true;
+    for (;;) {
+        Lexeme lexeme = lexer.next();
+        if (lexeme.type == LEX_END)
+            break;
+
+        if (statement_start && lexeme.type == LEX_IDENT &&
+            lexeme.text == "include" && lexer.peek().type == LEX_STRING) {
+            std::string file_name(lexer.next().text);
+            if (std::find(path.begin(), path.end(), file_name) != path.end())
+                throw "Recursive include";
+
+            hash.add_string(file_name);
+            std::string contents;
+            bool found = read_file(file_name, contents);
+            hash.add_int(found);
+            if (found) {
+                path.push_back(file_name);
+                hash_source_rec(contents, hash, path);
+                path.pop_back();
+            }
+            lexeme = lexer.next();
+        }
+
+        statement_start = lexeme.type == LEX_NEWLINE;
+    }
+}
+
+uint64_t CompileCache::hash_source(const std::string &source)
+{
+    SourceHash hash;
+    std::vector<std::string> path;
+
+    hash_source_rec(source, hash, path);
+
+    return hash.get();
+}
+
+CompileCache::CompileCache(const std::string &dir)
+    : dir(dir)
+{
+    // If this fails, so does every write, which is counted in the stats
+    mkdir(dir.c_str(), 0777);
+}
+
+compiler::SCDLProgram *CompileCache::compile(const std::string &source,
+                                             const CompileOptions &options)
+{
+    return lookup(source, NULL, options).program;
+}
+
+CompilerResult CompileCache::compile(const std::string &source,
+                                     const std::string &vars_source,
+                                     const CompileOptions &options)
+{
+    return lookup(source, &vars_source, options);
+}
+
+CompilerResult CompileCache::lookup(const std::string &source,
+                                    const std::string *vars_source,
+                                    const CompileOptions &options)
+{
+    SourceHash hash;
+    hash.add_int(PROGRAM_IMAGE_VERSION);
+    hash.add_int(options.optimize);
+    hash.add_int(options.minimize_mults);
+    hash.add_int(options.target_depth);
+    hash.add_int(options.outputs.size());
+    for (size_t i = 0; i < options.outputs.size(); i++)
+        hash.add_string(options.outputs[i]);
+    hash.add_int(vars_source != NULL);
+    if (vars_source != NULL)
+        hash.add_string(*vars_source);
+    hash.add_int(hash_source(source));
+
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx", (unsigned long long) hash.get());
+    std::string entry = dir + "/" + key + ".img";
+
+    CompilerResult result;
+    if (ProgramImage::is_image(entry)) {
+        try {
+            result = ProgramImage::load(entry);
+            stats.n_hits++;
+            return result;
+        }
+        catch (const char *) {
+            // Unreadable, it is overwritten below
+            stats.n_errors++;
+        }
+    }
+
+    stats.n_misses++;
+    CompileOptions vars_options = options;
+    if (vars_source != NULL) {
+        std::istringstream vars_in(*vars_source);
+        Vars *vars = read_vars_file(vars_in);
+        result.vars = *vars;
+        delete vars;
+        // As in SCDLEvaluator::compile, the key already covers the vars
+        if (vars_options.outputs.empty())
+            vars_options.outputs = output_wires(result.vars);
+    }
+    std::istringstream is(source);
+    result.program = compiler::SCDLProgram::compile_program_from_stream(
+        is, vars_options);
+
+    std::string tmp = entry + ".tmp." + std::to_string(getpid());
+    try {
+        ProgramImage::save(result.program,
+                           vars_source != NULL ? &result.vars : NULL, tmp);
+        if (rename(tmp.c_str(), entry.c_str()) != 0)
+            throw "Could not write cache entry";
+    }
+    catch (const char *) {
+        remove(tmp.c_str());
+        stats.n_errors++;
+    }
+
+    return result;
+}
+
+}
@@ -0,0 +1,73 @@
+#ifndef COMPILE_CACHE_H
+#define COMPILE_CACHE_H
+
+#include <string>
+#include <cstdlib>
+#include <stdint.h>
+
+#include "SCDLProgram.h"
+#include "SCDLEvaluator.h"
+
+namespace scdl {
+
+struct CacheStats {
+    CacheStats() : n_hits(0), n_misses(0), n_errors(0) {}
+
+    size_t n_hits;
+    size_t n_misses;
+    size_t n_errors;    // entries that could not be loaded or written
+};
+
+/*
+ * On-disk cache of compiled programs. An entry is the program image (see
+ * ProgramImage.h) of a compilation, named after a hash of everything the
+ * compilation depends on: the source, the content of every file it
+ * includes, transitively, the vars metadata, the compile options and the
+ * image version. Changing an included file therefore changes the key, and
+ * an unchanged program is mapped from its image without running the front
+ * end or building any circuit.
+ *
+ * Includes are found by lexing the sources, which is all that runs on a
+ * hit. Entries are written to a temporary file and renamed into place, so
+ * several processes may share one cache directory. A cache is a local
+ * optimization: an entry that cannot be loaded is recompiled and one that
+ * cannot be written is skipped.
+ */
+class CompileCache {
+ public:
+    /* The directory is created if it does not exist */
+    CompileCache(const std::string &dir);
+
+    compiler::SCDLProgram *compile(const std::string &source,
+        const CompileOptions &options=CompileOptions());
+
+    /*
+     * Same, along with the vars metadata read from vars_source. Unless
+     * options names them, the outputs are the output wires of the vars.
+     */
+    CompilerResult compile(const std::string &source,
+                           const std::string &vars_source,
+                           const CompileOptions &options=CompileOptions());
+
+    const CacheStats &get_stats() const {
+        return stats;
+    }
+
+    /*
+     * Hash of source and the files it includes. Included files that cannot
+     * be read are hashed by name only, so that the compilation reports them.
+     */
+    static uint64_t hash_source(const std::string &source);
+
+ private:
+    CompilerResult lookup(const std::string &source,
+                          const std::string *vars_source,
+                          const CompileOptions &options);
+
+    std::string dir;
+    CacheStats stats;
+};
+
+}
+
+#endif // COMPILE_CACHE_H
@@ -0,0 +1,45 @@
+#include "Dataflow.h"
+
+#include <algorithm>
+
+namespace scdl {
+
+DataflowExecutor::DataflowExecutor(const Circuit *circuit,
+                                   unsigned int n_threads)
+    : circuit(circuit), n_threads(n_threads)
+{
+    if (this->n_threads == 0)
+        this->n_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    size_t n_gates = circuit->get_num_gates();
+    CircuitStats stats(circuit);
+
+    // Consumers of every gate in CSR form. A gate that uses the same input
+    // twice appears twice, matching its count of pending input edges.
+    fanout_offsets.assign(n_gates + 1, 0);
+    for (size_t i = 0; i < n_gates; i++)
+        fanout_offsets[i + 1] = fanout_offsets[i] + stats.get_fan_out(i);
+
+    std::vector<unsigned int> next(fanout_offsets.begin(),
+                                   fanout_offsets.end() - 1);
+    fanout_gates.resize(fanout_offsets[n_gates]);
+    for (size_t i = 0; i < n_gates; i++) {
+        const unsigned int *in_gates = circuit->get_in_gates(i);
+        for (size_t j = 0; j < circuit->get_fan_in(i); j++)
+            fanout_gates[next[in_gates[j]]++] = i;
+    }
+
+    // Remaining multiplicative depth, computed in reverse topological order
+    priority.assign(n_gates, 0);
+    for (size_t i = n_gates; i-- > 0;) {
+        int below = 0;
+        for (unsigned int k = fanout_offsets[i]; k < fanout_offsets[i + 1];
+             k++)
+            below = std::max(below, priority[fanout_gates[k]]);
+        priority[i] = below + (circuit->get_gate_type(i) == GATE_MULT);
+    }
+
+    circuit->get_gate_levels(level_of);
+}
+
+}
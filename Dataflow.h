@@ -0,0 +1,310 @@
+#ifndef DATAFLOW_H
+#define DATAFLOW_H
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <utility>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstdlib>
+
+#include "Circuit.h"
+
+namespace scdl {
+
+/*
+ * Dataflow executor for a Circuit. Every gate keeps an atomic count of the
+ * input edges that are still pending and fires as soon as it drops to
+ * zero, so there is no barrier between levels. Each worker thread owns
+ * deques of ready gates and steals from the other workers when it runs dry.
+ * A worker takes the gates it released itself from the back of its deques,
+ * while their operands are still in its cache, and thieves take the oldest
+ * gates from the front. Workers that find nothing to run or steal sleep
+ * until a gate is released.
+ *
+ * Ready gates are ordered by the number of GATE_MULT gates on the longest
+ * path from the gate to the output (remaining multiplicative depth): each
+ * worker keeps one deque per priority and serves the highest first, so the
+ * critical chain of multiplications is always scheduled first.
+ */
+class DataflowExecutor {
+ public:
+    /* If n_threads is 0 the number of hardware threads is used */
+    DataflowExecutor(const Circuit *circuit, unsigned int n_threads=0);
+
+    unsigned int get_num_threads() const {
+        return n_threads;
+    }
+
+    /* Remaining multiplicative depth of a gate, used as its priority */
+    int get_priority(unsigned int gate_index) const {
+        return priority[gate_index];
+    }
+
+    /* Only reads the executor, so it may be called from several threads */
+    template <class T>
+    T evaluate(const T *inputs) const {
+        std::vector<T> outputs;
+        evaluate_all(inputs, outputs);
+        return outputs[0];
+    }
+
+    /*
+     * outputs[i] receives the value of output i of the circuit. If stats is
+     * not NULL the evaluation is added to it as by Circuit::evaluate_all;
+     * the time of each level sums that of its gates over all the workers.
+     */
+    template <class T>
+    void evaluate_all(const T *inputs, std::vector<T> &outputs,
+                      EvalStats *stats=NULL) const {
+        std::vector<T> values;
+        run(NULL, inputs, values, circuit->get_num_outputs(), stats);
+
+        outputs.clear();
+        for (size_t i = 0; i < circuit->get_num_outputs(); i++)
+            outputs.push_back(values[circuit->get_output_gate_index(i)]);
+    }
+
+    /* Same as above over the gates of a cone of the circuit only */
+    template <class T>
+    void evaluate_cone(const CircuitCone &cone, const T *inputs,
+                       std::vector<T> &outputs, EvalStats *stats=NULL) const {
+        std::vector<T> values;
+        run(&cone, inputs, values, cone.get_num_outputs(), stats);
+
+        outputs.clear();
+        for (size_t i = 0; i < cone.get_num_outputs(); i++)
+            outputs.push_back(values[cone.get_output_gate_index(i)]);
+    }
+
+ private:
+    // Pending count of the gates outside the cone being evaluated, which
+    // never drops to zero
+    static const unsigned int NOT_IN_CONE = (unsigned int) -1;
+
+    /*
+     * Ready gates owned by one worker, in a deque per priority. The owner
+     * pops the newest gate of the highest priority, a thief steals the
+     * oldest one.
+     */
+    class ReadyQueue {
+     public:
+        void push(int prio, unsigned int gate_index) {
+            std::lock_guard<std::mutex> lock(mutex);
+            deques[prio].push_back(gate_index);
+        }
+
+        bool pop(unsigned int *gate_index, bool steal) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (deques.empty())
+                return false;
+
+            std::map<int,std::deque<unsigned int> >::iterator highest =
+                --deques.end();
+            std::deque<unsigned int> &deque = highest->second;
+            if (steal) {
+                *gate_index = deque.front();
+                deque.pop_front();
+            }
+            else {
+                *gate_index = deque.back();
+                deque.pop_back();
+            }
+            if (deque.empty())
+                deques.erase(highest);
+            return true;
+        }
+
+     private:
+        std::mutex mutex;
+        // Only priorities with ready gates have a deque
+        std::map<int,std::deque<unsigned int> > deques;
+    };
+
+    /* What the workers of one evaluation share besides the queues */
+    struct Schedule {
+        explicit Schedule(size_t n_gates)
+            : remaining(n_gates), n_ready(0), n_sleeping(0) {}
+
+        std::atomic<size_t> remaining;      // gates not evaluated yet
+        std::atomic<size_t> n_ready;        // gates in the queues
+        std::atomic<unsigned int> n_sleeping;
+        std::mutex mutex;
+        std::condition_variable wake;
+    };
+
+    /*
+     * A worker sleeps once it found nothing to run, until a gate is pushed
+     * or the last gate is done. n_ready and n_sleeping are sequentially
+     * consistent, so either the pusher sees the sleeper and notifies it
+     * under the mutex, or the sleeper sees the new gate before waiting.
+     */
+    void release(Schedule *schedule, ReadyQueue *queue, int prio,
+                 unsigned int gate_index) const {
+        queue->push(prio, gate_index);
+        schedule->n_ready++;
+        if (schedule->n_sleeping > 0) {
+            std::lock_guard<std::mutex> lock(schedule->mutex);
+            schedule->wake.notify_one();
+        }
+    }
+
+    void sleep(Schedule *schedule) const {
+        std::unique_lock<std::mutex> lock(schedule->mutex);
+        schedule->n_sleeping++;
+        while (schedule->n_ready == 0 && schedule->remaining > 0)
+            schedule->wake.wait(lock);
+        schedule->n_sleeping--;
+    }
+
+    /* Evaluates the gates of cone, or all of them, into values */
+    template <class T>
+    void run(const CircuitCone *cone, const T *inputs, std::vector<T> &values,
+             size_t n_outputs, EvalStats *stats) const {
+        if (stats == NULL) {
+            std::vector<NullTracer> tracers(n_threads);
+            execute(cone, inputs, values, &tracers[0]);
+            return;
+        }
+
+        // Every worker counts and times its own gates, merged at the end
+        size_t n_levels = circuit->get_num_levels();
+        std::vector<EvalStats> worker_stats(n_threads);
+        std::vector<StatsTracer> tracers;
+        for (unsigned int t = 0; t < n_threads; t++)
+            tracers.push_back(StatsTracer(worker_stats[t], n_levels,
+                                          &level_of));
+
+        StatsTracer tracer(*stats, n_levels);
+        tracer.on_storage(circuit->get_num_gates(), true);
+        tracer.on_copies(n_outputs);
+        execute(cone, inputs, values, &tracers[0]);
+
+        for (unsigned int t = 0; t < n_threads; t++) {
+            for (size_t type = 0; type < 4; type++)
+                stats->n_gates[type] += worker_stats[t].n_gates[type];
+            stats->n_copies += worker_stats[t].n_copies;
+            for (size_t l = 0; l < n_levels; l++)
+                stats->level_seconds[l] += worker_stats[t].level_seconds[l];
+        }
+        tracer.finish();
+    }
+
+    template <class T, class Tracer>
+    void execute(const CircuitCone *cone, const T *inputs,
+                 std::vector<T> &values, Tracer *tracers) const {
+        size_t n_gates = circuit->get_num_gates();
+
+        // T may not have a default constructor (see Circuit::evaluate)
+        values.reserve(n_gates);
+        for (size_t i = 0; i < n_gates; i++)
+            values.push_back(inputs[0]);
+
+        std::vector<std::atomic<unsigned int> > pending(n_gates);
+        if (cone != NULL) {
+            for (size_t i = 0; i < n_gates; i++)
+                pending[i].store(NOT_IN_CONE, std::memory_order_relaxed);
+        }
+
+        size_t n_scheduled = (cone != NULL) ? cone->get_num_gates() : n_gates;
+        std::vector<ReadyQueue> queues(n_threads);
+        Schedule schedule(n_scheduled);
+
+        // Seed the input gates round-robin over the workers
+        unsigned int w = 0;
+        for (size_t k = 0; k < n_scheduled; k++) {
+            unsigned int i = (cone != NULL) ? cone->get_gate_index(k) : k;
+            size_t fan_in = circuit->get_fan_in(i);
+            pending[i].store(fan_in, std::memory_order_relaxed);
+            if (fan_in == 0) {
+                queues[w].push(priority[i], i);
+                schedule.n_ready++;
+                w = (w + 1) % n_threads;
+            }
+        }
+
+        std::vector<std::thread> workers;
+        for (unsigned int t = 1; t < n_threads; t++) {
+            workers.push_back(std::thread(
+                &DataflowExecutor::work<T, Tracer>, this, t, inputs,
+                &values[0], &pending[0], &queues[0], &schedule,
+                &tracers[t]));
+        }
+        work<T, Tracer>(0, inputs, &values[0], &pending[0], &queues[0],
+                        &schedule, &tracers[0]);
+
+        for (size_t t = 0; t < workers.size(); t++)
+            workers[t].join();
+    }
+
+    template <class T, class Tracer>
+    void work(unsigned int id, const T *inputs, T *values,
+              std::atomic<unsigned int> *pending, ReadyQueue *queues,
+              Schedule *schedule, Tracer *tracer) const {
+        while (schedule->remaining > 0) {
+            unsigned int gate_index;
+            bool found = queues[id].pop(&gate_index, false);
+
+            // Steal from the other workers
+            for (unsigned int k = 1; !found && k < n_threads; k++)
+                found = queues[(id + k) % n_threads].pop(&gate_index, true);
+
+            if (!found) {
+                sleep(schedule);
+                continue;
+            }
+            schedule->n_ready--;
+
+            tracer->begin_gate();
+            GateType type = circuit->get_gate_type(gate_index);
+            const unsigned int *in_gates = circuit->get_in_gates(gate_index);
+            if (type == GATE_IN) {
+                values[gate_index] = inputs[in_gates[0]];
+                tracer->end_gate(gate_index, type, 1);
+            }
+            else {
+                T aggr = values[in_gates[0]];
+                size_t fan_in = circuit->get_fan_in(gate_index);
+                for (size_t j = 1; j < fan_in; j++) {
+                    if (type == GATE_MULT)
+                        aggr *= values[in_gates[j]];
+                    else if (type == GATE_ADD)
+                        aggr += values[in_gates[j]];
+                }
+                values[gate_index] = aggr;
+                tracer->end_gate(gate_index, type, 2);
+            }
+
+            // Release the consumers whose last pending input this was
+            for (unsigned int k = fanout_offsets[gate_index];
+                 k < fanout_offsets[gate_index + 1]; k++) {
+                unsigned int consumer = fanout_gates[k];
+                if (pending[consumer].fetch_sub(1,
+                                                std::memory_order_acq_rel) == 1)
+                    release(schedule, &queues[id], priority[consumer],
+                            consumer);
+            }
+
+            // The last gate wakes every sleeping worker up to return
+            if (--schedule->remaining == 0) {
+                std::lock_guard<std::mutex> lock(schedule->mutex);
+                schedule->wake.notify_all();
+            }
+        }
+    }
+
+    const Circuit *circuit;
+    unsigned int n_threads;
+    std::vector<unsigned int> fanout_offsets;
+    std::vector<unsigned int> fanout_gates;
+    std::vector<int> priority;
+    // Dependency level of every gate, to time the levels (see EvalStats)
+    std::vector<unsigned int> level_of;
+};
+
+}
+
+#endif // DATAFLOW_H
@@ -0,0 +1,113 @@
+#include "GateTable.h"
+
+#include <algorithm>
+
+namespace scdl {
+
+#define INITIAL_SLOTS 1024
+
+GateTable::GateTable()
+    : n_entries(0)
+{
+    Slot empty = {0, 0, 0, GATE_IN, NULL};
+    slots.assign(INITIAL_SLOTS, empty);
+}
+
+Gate *GateTable::find(GateType type, Gate *const *operands,
+                      size_t n_operands) const
+{
+    uintptr_t key[MAX_KEY_OPERANDS];
+    size_t n = sort_key(operands, n_operands, key);
+    uint64_t hash = hash_key(type, key, n);
+
+    return slots[probe(type, key, n, hash)].gate;
+}
+
+void GateTable::insert(GateType type, Gate *const *operands,
+                       size_t n_operands, Gate *gate)
+{
+    // Keep the load factor at most 1/2
+    if (2 * (n_entries + 1) > slots.size())
+        grow();
+
+    uintptr_t key[MAX_KEY_OPERANDS];
+    size_t n = sort_key(operands, n_operands, key);
+    uint64_t hash = hash_key(type, key, n);
+
+    Slot &slot = slots[probe(type, key, n, hash)];
+    if (slot.gate == NULL) {
+        slot.hash = hash;
+        slot.key = key_pool.size();
+        slot.n_operands = n;
+        slot.type = type;
+        key_pool.insert(key_pool.end(), key, key + n);
+        n_entries++;
+    }
+    slot.gate = gate;
+}
+
+size_t GateTable::sort_key(Gate *const *operands, size_t n_operands,
+                           uintptr_t *key)
+{
+    if (n_operands > MAX_KEY_OPERANDS)
+        throw "Too many operands for a gate table key";
+
+    for (size_t i = 0; i < n_operands; i++)
+        key[i] = (uintptr_t) operands[i];
+    std::sort(key, key + n_operands);
+
+    return n_operands;
+}
+
+uint64_t GateTable::hash_key(GateType type, const uintptr_t *key, size_t n)
+{
+    uint64_t h = (uint64_t) type * 0x9e3779b97f4a7c15ULL + n;
+    for (size_t i = 0; i < n; i++) {
+        // splitmix64 finalizer on each operand
+        uint64_t x = h ^ (uint64_t) key[i];
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        h = x ^ (x >> 31);
+    }
+
+    return h;
+}
+
+/* Index of the slot holding the key, or of the empty slot it would take */
+size_t GateTable::probe(GateType type, const uintptr_t *key, size_t n,
+                        uint64_t hash) const
+{
+    size_t mask = slots.size() - 1;
+    size_t i = hash & mask;
+
+    for (;;) {
+        const Slot &slot = slots[i];
+        if (slot.gate == NULL)
+            return i;
+        if (slot.hash == hash && slot.type == type && slot.n_operands == n &&
+            std::equal(key, key + n, key_pool.begin() + slot.key))
+            return i;
+        i = (i + 1) & mask;
+    }
+}
+
+void GateTable::grow()
+{
+    std::vector<Slot> old;
+    old.swap(slots);
+
+    Slot empty = {0, 0, 0, GATE_IN, NULL};
+    slots.assign(2 * old.size(), empty);
+
+    size_t mask = slots.size() - 1;
+    for (size_t j = 0; j < old.size(); j++) {
+        if (old[j].gate == NULL)
+            continue;
+        size_t i = old[j].hash & mask;
+        while (slots[i].gate != NULL)
+            i = (i + 1) & mask;
+        slots[i] = old[j];
+    }
+}
+
+}
@@ -0,0 +1,62 @@
+#ifndef GATE_TABLE_H
+#define GATE_TABLE_H
+
+#include <vector>
+#include <cstdlib>
+#include <stdint.h>
+
+#include "Circuit.h"
+
+namespace scdl {
+
+/* Most operands of a key in a GateTable */
+#define MAX_KEY_OPERANDS 16
+
+/*
+ * Structural hash table for hash-consing gates. A key is an operator and a
+ * multiset of operand gates: both operators are commutative, so operands
+ * are sorted before hashing and a*b and b*a share one entry. Keys with more
+ * than two operands stand for a whole chain of the same operator, such as
+ * (a*b)*c, which then matches a*(c*b) as well.
+ *
+ * The table uses open addressing with linear probing and keeps the
+ * operands of all keys in a single pool.
+ */
+class GateTable {
+ public:
+    GateTable();
+
+    /* Returns NULL if no gate has been inserted with this key */
+    Gate *find(GateType type, Gate *const *operands, size_t n_operands) const;
+
+    void insert(GateType type, Gate *const *operands, size_t n_operands,
+                Gate *gate);
+
+    size_t size() const {
+        return n_entries;
+    }
+
+ private:
+    struct Slot {
+        uint64_t hash;
+        size_t key;         // offset of the operands in key_pool
+        size_t n_operands;
+        GateType type;
+        Gate *gate;         // NULL for an empty slot
+    };
+
+    static size_t sort_key(Gate *const *operands, size_t n_operands,
+                           uintptr_t *key);
+    static uint64_t hash_key(GateType type, const uintptr_t *key, size_t n);
+    size_t probe(GateType type, const uintptr_t *key, size_t n,
+                 uint64_t hash) const;
+    void grow();
+
+    std::vector<Slot> slots;
+    std::vector<uintptr_t> key_pool;
+    size_t n_entries;
+};
+
+}
+
+#endif // GATE_TABLE_H
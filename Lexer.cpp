@@ -0,0 +1,157 @@
+#include "Lexer.h"
+
+namespace scdl {
+namespace compiler {
+
+static inline bool is_ident_start(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static inline bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static inline bool is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+Lexer::Lexer(std::string_view source)
+    : source(source), pos(0), line(1)
+{
+    lookahead = scan();
+}
+
+Lexeme Lexer::next()
+{
+    Lexeme lexeme = lookahead;
+    if (lexeme.type != LEX_END)
+        lookahead = scan();
+
+    return lexeme;
+}
+
+bool Lexer::accept(LexemeType type)
+{
+    if (lookahead.type != type)
+        return false;
+
+    next();
+    return true;
+}
+
+Lexeme Lexer::expect(LexemeType type, const char *error)
+{
+    if (lookahead.type != type)
+        throw error;
+
+    return next();
+}
+
+Lexeme Lexer::scan()
+{
+    size_t n = source.size();
+
+    for (;;) {
+        while (pos < n && is_blank(source[pos]))
+            pos++;
+
+        if (pos < n && source[pos] == '#') {
+            while (pos < n && source[pos] != '\n')
+                pos++;
+        }
+        else if (pos < n && source[pos] == '\\') {
+            // A backslash at the end of a line continues the statement
+            size_t end = pos + 1;
+            while (end < n && is_blank(source[end]))
+                end++;
+            if (end < n && source[end] != '\n')
+                throw "Unexpected character after \\";
+            pos = end + 1;
+            line++;
+            continue;
+        }
+        break;
+    }
+
+    Lexeme lexeme;
+    lexeme.line = line;
+    if (pos >= n) {
+        lexeme.type = LEX_END;
+        lexeme.text = std::string_view();
+        return lexeme;
+    }
+
+    size_t start = pos;
+    char c = source[pos++];
+
+    if (is_ident_start(c)) {
+        while (pos < n && (is_ident_start(source[pos]) ||
+                           is_digit(source[pos])))
+            pos++;
+        lexeme.type = LEX_IDENT;
+    }
+    else if (is_digit(c)) {
+        while (pos < n && is_digit(source[pos]))
+            pos++;
+        lexeme.type = LEX_NUMBER;
+    }
+    else if (c == '"') {
+        while (pos < n && source[pos] != '"' && source[pos] != '\n')
+            pos++;
+        if (pos >= n || source[pos] != '"')
+            throw "Unterminated string";
+        lexeme.type = LEX_STRING;
+        lexeme.text = source.substr(start + 1, pos - start - 1);
+        pos++;
+        return lexeme;
+    }
+    else {
+        switch (c) {
+            case '\n':
+                line++;
+                lexeme.type = LEX_NEWLINE;
+                break;
+            case '(':
+                lexeme.type = LEX_LEFT_PAREN;
+                break;
+            case ')':
+                lexeme.type = LEX_RIGHT_PAREN;
+                break;
+            case '[':
+                lexeme.type = LEX_LEFT_BRACKET;
+                break;
+            case ']':
+                lexeme.type = LEX_RIGHT_BRACKET;
+                break;
+            case '+':
+                lexeme.type = LEX_PLUS;
+                break;
+            case '*':
+                lexeme.type = LEX_STAR;
+                break;
+            case '-':
+                lexeme.type = LEX_MINUS;
+                break;
+            case ',':
+                lexeme.type = LEX_COMMA;
+                break;
+            case ':':
+                lexeme.type = LEX_COLON;
+                break;
+            case '=':
+                lexeme.type = LEX_EQUALS;
+                break;
+            default:
+                throw "Unexpected character";
+        }
+    }
+    lexeme.text = source.substr(start, pos - start);
+
+    return lexeme;
+}
+
+}
+}
@@ -0,0 +1,73 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <string_view>
+#include <cstdlib>
+
+namespace scdl {
+namespace compiler {
+
+enum LexemeType {
+    LEX_END,
+    LEX_NEWLINE,
+    LEX_IDENT,
+    LEX_NUMBER,
+    LEX_STRING,     // text excludes the quotes
+    LEX_LEFT_PAREN,
+    LEX_RIGHT_PAREN,
+    LEX_LEFT_BRACKET,
+    LEX_RIGHT_BRACKET,
+    LEX_PLUS,
+    LEX_STAR,
+    LEX_MINUS,
+    LEX_COMMA,
+    LEX_COLON,
+    LEX_EQUALS
+};
+
+/* The text of a lexeme points into the source buffer of the Lexer */
+struct Lexeme {
+    LexemeType type;
+    std::string_view text;
+    unsigned int line;
+};
+
+/*
+ * Splits SCDL source into lexemes in a single pass over one buffer, which
+ * must outlive the lexemes. Statements end at a newline unless the line
+ * ends with a backslash; comments run from # to the end of the line.
+ *
+ * A Lexer is a position in the buffer, so copying it gives any amount of
+ * lookahead.
+ */
+class Lexer {
+ public:
+    Lexer(std::string_view source);
+
+    /* Returns the next lexeme and consumes it */
+    Lexeme next();
+
+    /* Returns the next lexeme without consuming it */
+    const Lexeme &peek() const {
+        return lookahead;
+    }
+
+    /* Consumes the next lexeme if it has the given type */
+    bool accept(LexemeType type);
+
+    /* Consumes the next lexeme, throws if it does not have the given type */
+    Lexeme expect(LexemeType type, const char *error);
+
+ private:
+    Lexeme scan();
+
+    std::string_view source;
+    size_t pos;
+    unsigned int line;
+    Lexeme lookahead;
+};
+
+}
+}
+
+#endif // LEXER_H
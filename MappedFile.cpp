@@ -0,0 +1,38 @@
+#include "MappedFile.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace scdl {
+
+MappedFile::MappedFile(const std::string &file_name)
+    : data(NULL), size(0)
+{
+    int fd = open(file_name.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw "Could not open file";
+
+    // An empty file cannot be mapped
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        throw "Could not map file";
+    }
+
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        throw "Could not map file";
+
+    data = static_cast<const char*>(p);
+    size = st.st_size;
+}
+
+MappedFile::~MappedFile()
+{
+    munmap(const_cast<char*>(data), size);
+}
+
+}
@@ -0,0 +1,33 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <cstdlib>
+
+namespace scdl {
+
+/* Read-only shared mapping of a whole file */
+class MappedFile {
+ public:
+    MappedFile(const std::string &file_name);
+    ~MappedFile();
+
+    const char *get_data() const {
+        return data;
+    }
+
+    size_t get_size() const {
+        return size;
+    }
+
+ private:
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data;
+    size_t size;
+};
+
+}
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,668 @@
+#include "Optimizer.h"
+#include "Rewrite.h"
+
+#include <queue>
+#include <algorithm>
+
+namespace scdl {
+
+/*
+ * A product is only distributed over a sum with at most this many terms at
+ * the depth of the sum, which bounds the gates added by a single rewrite.
+ */
+#define MAX_CRITICAL_TERMS 4
+
+/*
+ * Most products a chain is distributed into, and most factors of a product
+ * that is distributed further, so that the rewrites of a chain stay within
+ * a constant number of gates
+ */
+#define MAX_DISTRIBUTED_TERMS 16
+#define MAX_DISTRIBUTED_FACTORS MAX_KEY_OPERANDS
+
+/*
+ * The rewrites stop once the optimizer has made this many times the number
+ * of gates of the original graph
+ */
+#define GATE_BUDGET_FACTOR 32
+
+/* Most passes of the rewriting that reduces the number of GATE_MULT */
+#define MAX_REWRITE_PASSES 4
+
+
+Optimizer::Optimizer(const CompileOptions &options,
+                     Arena &arena,
+                     const std::map<Gate*,int> &constant_gates)
+    : options(options), arena(arena),
+      constant_gates(constant_gates), gate_budget(0), n_distributed(0),
+      current_origin(NO_ORIGIN)
+{
+}
+
+void Optimizer::run(std::map<std::string,Gate*> &func_gates)
+{
+    measure(func_gates, &stats.depth_before, &stats.n_mult_before,
+            &stats.n_add_before);
+
+    std::map<std::string,Gate*>::iterator itr;
+    for (itr = func_gates.begin(); itr != func_gates.end(); itr++)
+        itr->second = simplify(itr->second);
+
+    if (!options.minimize_mults)
+        reduce_depth(func_gates);
+    else {
+        // Fewer multiplications can leave the depth pass with less to
+        // rebalance, so the program is also optimized without the rewriting,
+        // which is dropped unless it makes neither count worse
+        std::map<std::string,Gate*> plain = func_gates;
+        reduce_depth(plain);
+        reduce_mults(func_gates);
+        reduce_depth(func_gates);
+
+        int depth, plain_depth;
+        size_t n_mult, n_add, plain_n_mult, plain_n_add;
+        measure(func_gates, &depth, &n_mult, &n_add);
+        measure(plain, &plain_depth, &plain_n_mult, &plain_n_add);
+        if (n_mult > plain_n_mult || deeper(depth, plain_depth))
+            func_gates.swap(plain);
+    }
+
+    measure(func_gates, &stats.depth_after, &stats.n_mult_after,
+            &stats.n_add_after);
+}
+
+/*
+ * Whether a graph of the given depth is worse than one of depth reference,
+ * which it is not as long as it meets the target depth
+ */
+bool Optimizer::deeper(int depth, int reference) const
+{
+    return depth > std::max(reference, options.target_depth);
+}
+
+/*
+ * Runs XagRewriter until a pass stops paying off. A pass that does not
+ * remove multiplications, or that deepens the program, is undone.
+ */
+void Optimizer::reduce_mults(std::map<std::string,Gate*> &func_gates)
+{
+    int depth;
+    size_t n_mult, n_add;
+    measure(func_gates, &depth, &n_mult, &n_add);
+
+    // Gates shared between functions keep a rewrite from paying off until
+    // their other users have been rewritten, so the pass is repeated
+    for (int pass = 0; pass < MAX_REWRITE_PASSES; pass++) {
+        std::map<std::string,Gate*> before = func_gates;
+        XagRewriter rewriter(arena, constant_gates);
+        rewriter.run(func_gates);
+
+        int depth_pass;
+        size_t n_mult_pass, n_add_pass;
+        measure(func_gates, &depth_pass, &n_mult_pass, &n_add_pass);
+        if (n_mult_pass >= n_mult || deeper(depth_pass, depth)) {
+            func_gates.swap(before);
+            break;
+        }
+        n_mult = n_mult_pass;
+        depth = depth_pass;
+    }
+}
+
+/*
+ * The depth pass. Its result replaces the graph only if it is shallower.
+ */
+void Optimizer::reduce_depth(std::map<std::string,Gate*> &func_gates)
+{
+    int depth_before;
+    size_t n_mult, n_add;
+    measure(func_gates, &depth_before, &n_mult, &n_add);
+
+    // The chains and the rebalanced gates depend on the graph
+    fan_out.clear();
+    balanced[0].clear();
+    balanced[1].clear();
+    shared_outputs.clear();
+    distributed_products = GateTable();
+
+    std::map<std::string,Gate*>::iterator itr;
+    std::unordered_set<Gate*> visited;
+    function_gates.clear();
+    for (itr = func_gates.begin(); itr != func_gates.end(); itr++) {
+        // A function output is used by the function itself
+        fan_out[itr->second]++;
+        function_gates.insert(itr->second);
+        count_fan_out(itr->second, visited);
+    }
+
+    gate_budget = made_gates.size() + GATE_BUDGET_FACTOR *
+                  (stats.n_mult_before + stats.n_add_before + 1);
+
+    // The rewrites are applied to every function or to none, so that the
+    // circuits do not mix two rebalanced copies of their shared gates. They
+    // are dropped if they do not lower the depth of the program.
+    int depth = 0;
+    for (itr = func_gates.begin(); itr != func_gates.end(); itr++)
+        depth = std::max(depth, get_info(balance(itr->second, false)).depth);
+
+    bool rewrite = false;
+    if (options.target_depth < 0 || depth > options.target_depth) {
+        int rewritten_depth = 0;
+        for (itr = func_gates.begin(); itr != func_gates.end(); itr++) {
+            Gate *gate = balance(itr->second, true);
+            rewritten_depth = std::max(rewritten_depth, get_info(gate).depth);
+        }
+        rewrite = rewritten_depth < depth;
+        depth = std::min(depth, rewritten_depth);
+    }
+
+    // Rebalancing alone may duplicate products, which is only worth it for
+    // a lower depth
+    if (depth >= depth_before)
+        return;
+
+    for (itr = func_gates.begin(); itr != func_gates.end(); itr++)
+        itr->second = balance(itr->second, rewrite);
+}
+
+/* Returns the simplified copy of a gate of the original graph */
+Gate *Optimizer::simplify(Gate *gate)
+{
+    if (gate->type == GATE_IN)
+        return gate;
+
+    std::map<Gate*,Gate*>::iterator itr = simplified.find(gate);
+    if (itr != simplified.end())
+        return itr->second;
+
+    // Post-order walk without recursion as the graph may be deep
+    std::vector<std::pair<Gate*,size_t> > stack;
+    stack.push_back(std::make_pair(gate, (size_t) 0));
+    while (!stack.empty()) {
+        Gate *g = stack.back().first;
+        size_t next = stack.back().second;
+
+        if (next < g->fan_in) {
+            stack.back().second++;
+            Gate *in = g->in_gates[next];
+            if (in->type != GATE_IN && simplified.find(in) == simplified.end())
+                stack.push_back(std::make_pair(in, (size_t) 0));
+            continue;
+        }
+        stack.pop_back();
+
+        std::vector<Gate*> operands;
+        for (size_t i = 0; i < g->fan_in; i++) {
+            Gate *in = g->in_gates[i];
+            operands.push_back((in->type == GATE_IN) ? in : simplified[in]);
+        }
+
+        // The gates made in place of g take its origin
+        current_origin = g->origin;
+        Gate *result;
+        if (g->type == GATE_MULT)
+            result = simplify_product(operands);
+        else
+            result = simplify_sum(operands);
+
+        simplified[g] = result;
+    }
+
+    return simplified[gate];
+}
+
+Gate *Optimizer::simplify_sum(std::vector<Gate*> &terms)
+{
+    // Open up the operands that are themselves sums with a constant, so
+    // that (x+1)+1 cancels
+    for (size_t i = 0; i < terms.size(); i++) {
+        Gate *t = terms[i];
+        if (t->type != GATE_ADD)
+            continue;
+        bool with_constant = false;
+        for (size_t j = 0; j < t->fan_in; j++) {
+            if (constant_value(t->in_gates[j]) >= 0)
+                with_constant = true;
+        }
+        if (with_constant) {
+            terms[i] = t->in_gates[0];
+            terms.insert(terms.end(), t->in_gates + 1,
+                         t->in_gates + t->fan_in);
+            i--;
+        }
+    }
+
+    Gate *any = terms[0];
+    int parity = 0;
+    std::map<Gate*,int> count;
+    std::vector<Gate*> order;
+    for (size_t i = 0; i < terms.size(); i++) {
+        int value = constant_value(terms[i]);
+        if (value >= 0)
+            parity ^= value;
+        else if (count[terms[i]]++ == 0)
+            order.push_back(terms[i]);
+    }
+
+    // x + x = 0
+    std::vector<Gate*> left;
+    for (size_t i = 0; i < order.size(); i++) {
+        if (count[order[i]] % 2)
+            left.push_back(order[i]);
+    }
+    if (parity)
+        left.push_back(constant_gate(1, any));
+
+    if (left.empty())
+        return constant_gate(0, any);
+
+    Gate *sum = left[0];
+    for (size_t i = 1; i < left.size(); i++)
+        sum = make_gate(GATE_ADD, sum, left[i]);
+    return sum;
+}
+
+Gate *Optimizer::simplify_product(std::vector<Gate*> &factors)
+{
+    Gate *any = factors[0];
+    std::vector<Gate*> left;
+    std::map<Gate*,int> seen;
+
+    for (size_t i = 0; i < factors.size(); i++) {
+        int value = constant_value(factors[i]);
+        if (value == 0)
+            return constant_gate(0, any);
+        // x * x = x
+        if (value < 0 && seen[factors[i]]++ == 0)
+            left.push_back(factors[i]);
+    }
+
+    // x * (x + 1) = 0
+    for (size_t i = 0; i < left.size(); i++) {
+        Gate *f = left[i];
+        if (f->type != GATE_ADD || f->fan_in != 2)
+            continue;
+        for (int k = 0; k < 2; k++) {
+            if (constant_value(f->in_gates[k]) == 1 &&
+                seen.find(f->in_gates[1 - k]) != seen.end())
+                return constant_gate(0, any);
+        }
+    }
+
+    if (left.empty())
+        return constant_gate(1, any);
+
+    Gate *product = left[0];
+    for (size_t i = 1; i < left.size(); i++)
+        product = make_gate(GATE_MULT, product, left[i]);
+    return product;
+}
+
+/*
+ * Input gate of a constant with the given value. Only 0 can be asked for
+ * without a constant of that value in the program (from x + x), and it is
+ * then made as the sum of a gate with itself.
+ */
+Gate *Optimizer::constant_gate(int value, Gate *any)
+{
+    Gate *found[2] = {NULL, NULL};
+    std::map<Gate*,int>::const_iterator itr;
+    for (itr = constant_gates.begin(); itr != constant_gates.end(); itr++) {
+        int v = itr->second % 2 != 0;
+        if (found[v] == NULL)
+            found[v] = itr->first;
+    }
+
+    if (found[value] != NULL)
+        return found[value];
+
+    Gate *base = (found[1] != NULL) ? found[1] : any;
+    return make_gate(GATE_ADD, base, base);
+}
+
+/* Value of a constant input gate, or -1 if the gate is not a constant */
+int Optimizer::constant_value(Gate *gate) const
+{
+    if (gate->type != GATE_IN)
+        return -1;
+
+    std::map<Gate*,int>::const_iterator itr = constant_gates.find(gate);
+    if (itr == constant_gates.end())
+        return -1;
+
+    return itr->second % 2 != 0;
+}
+
+/*
+ * Returns the rebalanced copy of a gate of the original graph. Chain
+ * operands shared with other gates are kept as operands, so no gate of the
+ * original graph is duplicated.
+ */
+Gate *Optimizer::balance(Gate *gate, bool rewrite)
+{
+    if (gate->type == GATE_IN)
+        return gate;
+
+    std::map<Gate*,Gate*> &memo = balanced[rewrite ? 1 : 0];
+    std::map<Gate*,Gate*>::iterator itr = memo.find(gate);
+    if (itr != memo.end())
+        return itr->second;
+
+    // Post-order walk over the chains without recursion as the graph may
+    // be deep: a chain is rebuilt once all its operands are
+    struct Frame {
+        Gate *gate;
+        std::vector<Gate*> operands;
+        size_t next;
+    };
+    std::vector<Frame> stack(1);
+    stack.back().gate = gate;
+    stack.back().next = 0;
+    collect_chain(gate, gate->type, true, stack.back().operands);
+
+    while (!stack.empty()) {
+        Frame &frame = stack.back();
+        if (frame.next < frame.operands.size()) {
+            Gate *in = frame.operands[frame.next++];
+            if (in->type == GATE_IN || memo.find(in) != memo.end())
+                continue;
+
+            Frame in_frame;
+            in_frame.gate = in;
+            in_frame.next = 0;
+            collect_chain(in, in->type, true, in_frame.operands);
+            stack.push_back(in_frame);
+            continue;
+        }
+
+        std::vector<Gate*> operands;
+        operands.swap(frame.operands);
+        Gate *g = frame.gate;
+        stack.pop_back();
+        for (size_t i = 0; i < operands.size(); i++) {
+            if (operands[i]->type != GATE_IN)
+                operands[i] = memo[operands[i]];
+        }
+
+        // The chain is rebuilt with the origin of its root
+        current_origin = g->origin;
+        Gate *result;
+        if (g->type == GATE_MULT) {
+            n_distributed = 0;
+            result = build_product(operands, rewrite);
+        }
+        else
+            result = build_chain(g->type, operands);
+
+        memo[g] = result;
+        if (function_gates.count(g) && fan_out[g] > 1)
+            shared_outputs.insert(result);
+    }
+
+    return memo[gate];
+}
+
+/*
+ * Combines the operands with binary gates, always joining the two
+ * shallowest ones (by multiplicative depth, then by overall depth).
+ */
+Gate *Optimizer::build_chain(GateType type, const std::vector<Gate*> &operands)
+{
+    struct Item {
+        int depth;
+        int level;
+        unsigned int seq;  // keeps the result independent of pointer values
+        Gate *gate;
+
+        bool operator>(const Item &other) const {
+            if (depth != other.depth)
+                return depth > other.depth;
+            if (level != other.level)
+                return level > other.level;
+            return seq > other.seq;
+        }
+    };
+
+    std::priority_queue<Item,std::vector<Item>,std::greater<Item> > queue;
+    unsigned int seq = 0;
+    for (size_t i = 0; i < operands.size(); i++) {
+        GateInfo gi = get_info(operands[i]);
+        Item item = {gi.depth, gi.level, seq++, operands[i]};
+        queue.push(item);
+    }
+
+    while (queue.size() > 1) {
+        Item a = queue.top();
+        queue.pop();
+        Item b = queue.top();
+        queue.pop();
+
+        Gate *g = make_gate(type, a.gate, b.gate);
+        GateInfo gi = get_info(g);
+        Item item = {gi.depth, gi.level, seq++, g};
+        queue.push(item);
+    }
+
+    return queue.top().gate;
+}
+
+/*
+ * Products are distributed over the sums in them (see the class comment)
+ * at most MAX_DISTRIBUTED_TERMS times per chain, never over the output of
+ * a function that other gates use, and once per set of factors.
+ * Distributing through a shared function output would copy its terms into
+ * every user, which on a chain of functions each using the one before
+ * compounds into a quadratic number of gates.
+ */
+Gate *Optimizer::build_product(const std::vector<Gate*> &factors, bool rewrite)
+{
+    if (!rewrite || factors.size() < 2 ||
+        factors.size() > MAX_DISTRIBUTED_FACTORS ||
+        made_gates.size() > gate_budget)
+        return build_chain(GATE_MULT, factors);
+
+    Gate *memo = distributed_products.find(GATE_MULT, &factors[0],
+                                           factors.size());
+    if (memo != NULL)
+        return memo;
+
+    Gate *product = distribute(factors);
+    distributed_products.insert(GATE_MULT, &factors[0], factors.size(),
+                                product);
+    return product;
+}
+
+Gate *Optimizer::distribute(const std::vector<Gate*> &factors)
+{
+    Gate *product = build_chain(GATE_MULT, factors);
+
+    // Deepest factor that is a sum
+    size_t sum = factors.size();
+    for (size_t i = 0; i < factors.size(); i++) {
+        if (factors[i]->type != GATE_ADD || shared_outputs.count(factors[i]))
+            continue;
+        if (sum == factors.size() ||
+            get_info(factors[i]).depth > get_info(factors[sum]).depth)
+            sum = i;
+    }
+    if (sum == factors.size() || get_info(factors[sum]).depth == 0)
+        return product;
+
+    int sum_depth = get_info(factors[sum]).depth;
+    std::vector<Gate*> terms;
+    collect_chain(factors[sum], GATE_ADD, false, terms);
+
+    std::vector<Gate*> critical;
+    std::vector<Gate*> shallow;
+    for (size_t i = 0; i < terms.size(); i++) {
+        if (get_info(terms[i]).depth == sum_depth)
+            critical.push_back(terms[i]);
+        else
+            shallow.push_back(terms[i]);
+    }
+    size_t n_products = critical.size() + (shallow.empty() ? 0 : 1);
+    if (critical.size() > MAX_CRITICAL_TERMS ||
+        n_distributed + n_products > MAX_DISTRIBUTED_TERMS)
+        return product;
+    n_distributed += n_products;
+
+    std::vector<Gate*> rest;
+    for (size_t i = 0; i < factors.size(); i++) {
+        if (i != sum)
+            rest.push_back(factors[i]);
+    }
+
+    std::vector<Gate*> products;
+    for (size_t i = 0; i < critical.size(); i++) {
+        std::vector<Gate*> term_factors = rest;
+        if (critical[i]->type == GATE_MULT)
+            collect_chain(critical[i], GATE_MULT, false, term_factors);
+        else
+            term_factors.push_back(critical[i]);
+        products.push_back(build_product(term_factors, true));
+    }
+    if (!shallow.empty()) {
+        std::vector<Gate*> term_factors = rest;
+        term_factors.push_back(build_chain(GATE_ADD, shallow));
+        products.push_back(build_product(term_factors, true));
+    }
+
+    Gate *distributed = build_chain(GATE_ADD, products);
+    if (get_info(distributed).depth < get_info(product).depth)
+        return distributed;
+
+    return product;
+}
+
+/* Allocates a binary gate, reusing an identical one made earlier */
+Gate *Optimizer::make_gate(GateType type, Gate *left, Gate *right)
+{
+    Gate *operands[2] = {left, right};
+    Gate *g = made_gates.find(type, operands, 2);
+    if (g != NULL)
+        return g;
+
+    g = arena.new_operator_gate(type, left, right);
+    g->origin = current_origin;
+    made_gates.insert(type, operands, 2, g);
+
+    GateInfo l = get_info(left);
+    GateInfo r = get_info(right);
+    GateInfo gi;
+    gi.depth = std::max(l.depth, r.depth) + (type == GATE_MULT ? 1 : 0);
+    gi.level = std::max(l.level, r.level) + 1;
+    info[g] = gi;
+
+    return g;
+}
+
+Optimizer::GateInfo Optimizer::get_info(Gate *gate) const
+{
+    std::map<Gate*,GateInfo>::const_iterator itr = info.find(gate);
+    if (itr != info.end())
+        return itr->second;
+
+    // Input gates
+    GateInfo gi = {0, 0};
+    return gi;
+}
+
+/*
+ * Appends the operands of the chain of type gates rooted at gate, from left
+ * to right. In the original graph the chain only extends through gates
+ * with no other user.
+ */
+void Optimizer::collect_chain(Gate *gate, GateType type, bool original,
+                              std::vector<Gate*> &operands) const
+{
+    // Gates still to visit, the next one last
+    std::vector<Gate*> stack(gate->in_gates, gate->in_gates + gate->fan_in);
+    std::reverse(stack.begin(), stack.end());
+    while (!stack.empty()) {
+        Gate *in = stack.back();
+        stack.pop_back();
+
+        bool absorb = in->type == type;
+        if (absorb && original)
+            absorb = fan_out.find(in)->second == 1;
+        else if (absorb)
+            absorb = shared_outputs.count(in) == 0;
+
+        if (absorb) {
+            for (size_t i = in->fan_in; i-- > 0; )
+                stack.push_back(in->in_gates[i]);
+        }
+        else
+            operands.push_back(in);
+    }
+}
+
+void Optimizer::count_fan_out(Gate *gate, std::unordered_set<Gate*> &visited)
+{
+    if (!visited.insert(gate).second)
+        return;
+
+    std::vector<Gate*> stack(1, gate);
+    while (!stack.empty()) {
+        Gate *g = stack.back();
+        stack.pop_back();
+
+        for (size_t i = 0; i < g->fan_in; i++) {
+            Gate *in = g->in_gates[i];
+            fan_out[in]++;
+            if (visited.insert(in).second)
+                stack.push_back(in);
+        }
+    }
+}
+
+/* Depth and gate counts of the union of the function circuits */
+void Optimizer::measure(std::map<std::string,Gate*> &func_gates, int *depth,
+                        size_t *n_mult, size_t *n_add)
+{
+    std::map<Gate*,int> gate_depth;
+    std::vector<std::pair<Gate*,size_t> > stack;
+
+    *depth = 0;
+    *n_mult = 0;
+    *n_add = 0;
+
+    std::map<std::string,Gate*>::iterator itr;
+    for (itr = func_gates.begin(); itr != func_gates.end(); itr++) {
+        if (gate_depth.find(itr->second) != gate_depth.end())
+            continue;
+
+        // Post-order walk without recursion as the graph may be deep
+        stack.push_back(std::make_pair(itr->second, (size_t) 0));
+        while (!stack.empty()) {
+            Gate *g = stack.back().first;
+            size_t next = stack.back().second;
+
+            if (next < g->fan_in) {
+                stack.back().second++;
+                Gate *in = g->in_gates[next];
+                if (gate_depth.find(in) == gate_depth.end())
+                    stack.push_back(std::make_pair(in, (size_t) 0));
+                continue;
+            }
+            stack.pop_back();
+            if (gate_depth.find(g) != gate_depth.end())
+                continue;
+
+            int d = 0;
+            for (size_t i = 0; i < g->fan_in; i++)
+                d = std::max(d, gate_depth[g->in_gates[i]]);
+            if (g->type == GATE_MULT) {
+                d++;
+                (*n_mult)++;
+            }
+            else if (g->type == GATE_ADD)
+                (*n_add)++;
+            gate_depth[g] = d;
+        }
+
+        *depth = std::max(*depth, gate_depth[itr->second]);
+    }
+}
+
+}
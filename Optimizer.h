@@ -0,0 +1,154 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_set>
+#include <cstdlib>
+
+#include "Circuit.h"
+#include "GateTable.h"
+#include "Arena.h"
+
+namespace scdl {
+
+/* Passed to SCDLProgram::compile_program_from_stream */
+struct CompileOptions {
+    CompileOptions()
+        : optimize(true), minimize_mults(true), target_depth(-1) {}
+
+    /* Run the optimization passes on the gate graph */
+    bool optimize;
+
+    /*
+     * Run the cut-based rewriting that reduces the number of GATE_MULT. It
+     * is kept only if the program ends up with no more GATE_MULT, and no
+     * deeper (beyond target_depth), than when optimized without it.
+     */
+    bool minimize_mults;
+
+    /*
+     * With a negative value the multiplicative depth is minimized, which
+     * may take more GATE_MULT than the source has. Otherwise the chains are
+     * only rebalanced, unless some function still exceeds target_depth
+     * after that, in which case the depth-reducing rewrites (which add
+     * gates) are applied as well.
+     */
+    int target_depth;
+
+    /*
+     * Functions the program keeps, all those without parameters if empty.
+     * Every function is still compiled, but only the gates these reach are
+     * optimized and kept, so circuits are built and analyzed for nothing
+     * else. Compilation is not deferred until a function is evaluated: if
+     * this is empty, all the functions are optimized and put in the gate
+     * pool up front. The program, and any image written from it, cannot
+     * evaluate a function that was left out.
+     */
+    std::vector<std::string> outputs;
+};
+
+/* Size of the gate graph of a program before and after optimization */
+struct OptimizeStats {
+    OptimizeStats()
+        : depth_before(0), depth_after(0), n_mult_before(0), n_mult_after(0),
+          n_add_before(0), n_add_after(0) {}
+
+    int depth_before;
+    int depth_after;
+    size_t n_mult_before;
+    size_t n_mult_after;
+    size_t n_add_before;
+    size_t n_add_after;
+};
+
+/*
+ * Rewrites the gate graph of a program between its construction from RPN
+ * and the construction of the Circuits. Gates are never modified: a
+ * rewritten gate is a new gate (allocated from the Arena of the program,
+ * which owns it) and the original graph is left unreachable.
+ *
+ * The graph is first simplified with the values of the constants, which
+ * are known at compile time: x*0 = 0, x*1 = x, x+0 = x, x+x = 0, x*x = x,
+ * x*(x+1) = 0 and (x+1)+1 = x, applied over chains of the same operator so
+ * that the results propagate. The number of multiplications is then reduced
+ * by XagRewriter (see Rewrite.h) and the depth pass runs last. A rewriting
+ * pass that removes no multiplication or deepens the program is undone, and
+ * the rewriting as a whole is dropped if the program optimized without it
+ * has no more multiplications and is no deeper (see CompileOptions).
+ *
+ * Depth pass: maximal chains of the same associative operator are
+ * collapsed into a list of operands and rebuilt as a tree that combines the
+ * two shallowest operands first, which gives the least multiplicative depth
+ * for the chain. Products whose deepest operand is a sum are additionally
+ * distributed over the terms that make the sum deep,
+ *     x * (a + b*c) = x*a + x*b*c,
+ * so that the factors of the deep terms join the product tree; this is
+ * kept only when it lowers the depth, and is bounded so that the pass stays
+ * linear in the size of the graph (see build_product). Rebalancing can itself duplicate
+ * products, so the result of the pass replaces the graph only if the
+ * program gets shallower.
+ */
+class Optimizer {
+ public:
+    /* constant_gates maps the input gates of constants to their value */
+    Optimizer(const CompileOptions &options,
+              Arena &arena,
+              const std::map<Gate*,int> &constant_gates);
+
+    /* Rewrites the output gate of every function in place */
+    void run(std::map<std::string,Gate*> &func_gates);
+
+    const OptimizeStats &get_stats() const {
+        return stats;
+    }
+
+ private:
+    struct GateInfo {
+        int depth;  // multiplicative depth
+        int level;  // depth counting every gate
+    };
+
+    bool deeper(int depth, int reference) const;
+    void reduce_mults(std::map<std::string,Gate*> &func_gates);
+    void reduce_depth(std::map<std::string,Gate*> &func_gates);
+    Gate *simplify(Gate *gate);
+    Gate *simplify_sum(std::vector<Gate*> &terms);
+    Gate *simplify_product(std::vector<Gate*> &factors);
+    Gate *constant_gate(int value, Gate *any);
+    int constant_value(Gate *gate) const;
+    Gate *balance(Gate *gate, bool rewrite);
+    Gate *build_chain(GateType type, const std::vector<Gate*> &operands);
+    Gate *build_product(const std::vector<Gate*> &factors, bool rewrite);
+    Gate *distribute(const std::vector<Gate*> &factors);
+    Gate *make_gate(GateType type, Gate *left, Gate *right);
+    GateInfo get_info(Gate *gate) const;
+    void collect_chain(Gate *gate, GateType type, bool original,
+                       std::vector<Gate*> &operands) const;
+    void count_fan_out(Gate *gate, std::unordered_set<Gate*> &visited);
+    void measure(std::map<std::string,Gate*> &func_gates, int *depth,
+                 size_t *n_mult, size_t *n_add);
+
+    const CompileOptions &options;
+    Arena &arena;
+    const std::map<Gate*,int> &constant_gates;
+    GateIndexMap fan_out;
+    std::unordered_set<Gate*> function_gates;  // outputs of the functions
+    // Rebalanced outputs of functions that other gates use, which products
+    // are not distributed through
+    std::unordered_set<Gate*> shared_outputs;
+    GateTable distributed_products;     // by their factors
+    size_t n_distributed;       // products the current chain was split into
+    std::map<Gate*,Gate*> simplified;
+    std::map<Gate*,Gate*> balanced[2];
+    std::map<Gate*,GateInfo> info;
+    GateTable made_gates;
+    size_t gate_budget;
+    unsigned int current_origin;    // of the gates make_gate allocates
+    OptimizeStats stats;
+};
+
+}
+
+#endif // OPTIMIZER_H
@@ -0,0 +1,392 @@
+#include "ProgramImage.h"
+
+#include <fstream>
+#include <cstring>
+
+namespace scdl {
+
+// Gate indices are stored as they are in a Circuit
+static_assert(sizeof(unsigned int) == sizeof(uint32_t),
+              "program images store gate indices as 32-bit integers");
+
+/*
+ * Builds an image in memory. The header is filled in last, the strings are
+ * appended as the final section.
+ */
+class ImageWriter {
+ public:
+    ImageWriter() : bytes(sizeof(ImageHeader), 0) {}
+
+    /* Returns the offset of the elements in the image */
+    template <class T>
+    uint64_t append(const T *elements, size_t n) {
+        bytes.resize((bytes.size() + 7) & ~(size_t) 7, 0);
+        uint64_t offset = bytes.size();
+        const char *p = reinterpret_cast<const char*>(elements);
+        bytes.insert(bytes.end(), p, p + n * sizeof(T));
+        return offset;
+    }
+
+    ImageString add_string(const std::string &s) {
+        ImageString image_string = {strings.size(), s.size()};
+        strings += s;
+        return image_string;
+    }
+
+    std::vector<char> bytes;
+    std::string strings;
+};
+
+static ImageCircuit write_circuit(ImageWriter &writer,
+                                  const Circuit *circuit)
+{
+    CircuitLayout layout = circuit->get_layout();
+    ImageCircuit ic;
+
+    ic.n_inputs = layout.n_inputs;
+    ic.n_add_gates = layout.n_add_gates;
+    ic.n_mult_gates = layout.n_mult_gates;
+    ic.n_slots = layout.n_slots;
+    ic.mult_depth = layout.mult_depth;
+    ic.binary = layout.binary;
+    ic.n_gates = layout.n_gates;
+    ic.n_operands = layout.n_operands;
+    ic.n_outputs = layout.n_outputs;
+    ic.n_levels = layout.n_levels;
+    ic.gate_types = writer.append(layout.gate_types, layout.n_gates);
+    ic.operand_offsets = layout.binary ? 0 :
+        writer.append(layout.operand_offsets, layout.n_gates + 1);
+    ic.operands = writer.append(layout.operands, layout.n_operands);
+    ic.output_gate_indices = writer.append(layout.output_gate_indices,
+                                           layout.n_outputs);
+    ic.level_offsets = writer.append(layout.level_offsets,
+                                     layout.n_levels + 1);
+    ic.level_gates = writer.append(layout.level_gates, layout.n_gates);
+    ic.slot_of = writer.append(layout.slot_of, layout.n_gates);
+    ic.origins = (layout.origins == NULL) ? 0 :
+        writer.append(layout.origins, layout.n_gates);
+
+    return ic;
+}
+
+static uint64_t write_vars(ImageWriter &writer,
+                           const std::vector<Variable> &vars)
+{
+    std::vector<ImageVar> image_vars;
+
+    for (size_t i = 0; i < vars.size(); i++) {
+        std::vector<ImageString> components;
+        for (size_t j = 0; j < vars[i].components.size(); j++)
+            components.push_back(writer.add_string(vars[i].components[j]));
+
+        ImageVar iv;
+        iv.name = writer.add_string(vars[i].name);
+        iv.type = vars[i].type;
+        iv.components = writer.append(components.data(), components.size());
+        iv.n_components = components.size();
+        image_vars.push_back(iv);
+    }
+
+    return writer.append(image_vars.data(), image_vars.size());
+}
+
+void ProgramImage::save(const compiler::SCDLProgram *prog, const Vars *vars,
+                        const std::string &file_name)
+{
+    ImageWriter writer;
+    ImageHeader header;
+    memset(&header, 0, sizeof(header));
+
+    std::vector<ImageVariable> variables;
+    std::map<std::string,compiler::Variable>::const_iterator vitr;
+    for (vitr = prog->var_map.begin(); vitr != prog->var_map.end(); vitr++) {
+        ImageVariable iv;
+        iv.name = writer.add_string(vitr->first);
+        iv.len = vitr->second.len;
+        iv.input_index = vitr->second.input_index;
+        variables.push_back(iv);
+    }
+    header.variables = writer.append(variables.data(), variables.size());
+    header.n_variables = variables.size();
+
+    std::vector<ImageConstant> constants;
+    std::map<std::string,compiler::Constant>::const_iterator citr;
+    for (citr = prog->const_map.begin(); citr != prog->const_map.end();
+         citr++) {
+        ImageConstant ic;
+        ic.name = writer.add_string(citr->first);
+        ic.value = citr->second.value;
+        ic.input_index = citr->second.input_index;
+        constants.push_back(ic);
+    }
+    header.constants = writer.append(constants.data(), constants.size());
+    header.n_constants = constants.size();
+
+    std::vector<ImageString> circuits;
+    for (size_t i = 0; i < prog->circuit_names.size(); i++)
+        circuits.push_back(writer.add_string(prog->circuit_names[i]));
+    header.circuits = writer.append(circuits.data(), circuits.size());
+    header.n_circuits = circuits.size();
+
+    // The gate pool has the functions as outputs, in circuit_names order
+    if (prog->gate_pool != NULL) {
+        ImageCircuit pool = write_circuit(writer, prog->gate_pool);
+        header.pool = writer.append(&pool, 1);
+    }
+
+    if (vars != NULL) {
+        header.vars_inputs = write_vars(writer, vars->inputs);
+        header.n_vars_inputs = vars->inputs.size();
+        header.vars_outputs = write_vars(writer, vars->outputs);
+        header.n_vars_outputs = vars->outputs.size();
+    }
+
+    const Provenance &provenance = prog->provenance;
+    std::vector<ImageString> function_names;
+    for (size_t i = 0; i < provenance.function_names.size(); i++)
+        function_names.push_back(
+            writer.add_string(provenance.function_names[i]));
+    header.function_names = writer.append(function_names.data(),
+                                          function_names.size());
+    header.n_function_names = function_names.size();
+
+    std::vector<ImageCallSite> call_sites;
+    for (size_t i = 0; i < provenance.call_sites.size(); i++) {
+        ImageCallSite site = {provenance.call_sites[i].function,
+                              provenance.call_sites[i].parent};
+        call_sites.push_back(site);
+    }
+    header.call_sites = writer.append(call_sites.data(), call_sites.size());
+    header.n_call_sites = call_sites.size();
+
+    const OptimizeStats &stats = prog->optimize_stats;
+    header.depth_before = stats.depth_before;
+    header.depth_after = stats.depth_after;
+    header.n_mult_before = stats.n_mult_before;
+    header.n_mult_after = stats.n_mult_after;
+    header.n_add_before = stats.n_add_before;
+    header.n_add_after = stats.n_add_after;
+
+    header.strings = writer.append(writer.strings.data(),
+                                   writer.strings.size());
+    header.n_string_bytes = writer.strings.size();
+
+    memcpy(header.magic, PROGRAM_IMAGE_MAGIC, sizeof(header.magic));
+    header.version = PROGRAM_IMAGE_VERSION;
+    header.byte_order = PROGRAM_IMAGE_BYTE_ORDER;
+    header.file_size = writer.bytes.size();
+    memcpy(&writer.bytes[0], &header, sizeof(header));
+
+    std::ofstream out(file_name.c_str(), std::ios::binary);
+    out.write(&writer.bytes[0], writer.bytes.size());
+    out.close();
+    if (!out)
+        throw "Could not write program image";
+}
+
+/* n elements of type T at offset, which must lie within the file */
+template <class T>
+static const T *section(const MappedFile *file, uint64_t offset, uint64_t n)
+{
+    if (offset % alignof(T) != 0 || offset > file->get_size() ||
+        n > (file->get_size() - offset) / sizeof(T))
+        throw "Corrupt program image";
+
+    return reinterpret_cast<const T*>(file->get_data() + offset);
+}
+
+static std::string get_string(const MappedFile *file,
+                              const ImageHeader *header,
+                              const ImageString &s)
+{
+    if (s.offset > header->n_string_bytes ||
+        s.len > header->n_string_bytes - s.offset)
+        throw "Corrupt program image";
+
+    const char *strings = section<char>(file, header->strings,
+                                        header->n_string_bytes);
+    return std::string(strings + s.offset, s.len);
+}
+
+static Circuit *load_circuit(const MappedFile *file, const ImageCircuit &ic)
+{
+    CircuitLayout layout;
+
+    if (ic.n_gates == 0 || ic.n_outputs == 0 ||
+        (ic.binary && ic.n_operands != 2 * ic.n_gates))
+        throw "Corrupt program image";
+
+    layout.n_inputs = ic.n_inputs;
+    layout.n_add_gates = ic.n_add_gates;
+    layout.n_mult_gates = ic.n_mult_gates;
+    layout.n_slots = ic.n_slots;
+    layout.mult_depth = ic.mult_depth;
+    layout.binary = ic.binary;
+    layout.n_gates = ic.n_gates;
+    layout.n_operands = ic.n_operands;
+    layout.n_outputs = ic.n_outputs;
+    layout.n_levels = ic.n_levels;
+    layout.gate_types = section<uint8_t>(file, ic.gate_types, ic.n_gates);
+    layout.operand_offsets = ic.binary ? NULL :
+        section<unsigned int>(file, ic.operand_offsets, ic.n_gates + 1);
+    layout.operands = section<unsigned int>(file, ic.operands,
+                                            ic.n_operands);
+    layout.output_gate_indices =
+        section<unsigned int>(file, ic.output_gate_indices, ic.n_outputs);
+    layout.level_offsets = section<unsigned int>(file, ic.level_offsets,
+                                                 ic.n_levels + 1);
+    layout.level_gates = section<unsigned int>(file, ic.level_gates,
+                                               ic.n_gates);
+    layout.slot_of = section<unsigned int>(file, ic.slot_of, ic.n_gates);
+    layout.origins = (ic.origins == 0) ? NULL :
+        section<unsigned int>(file, ic.origins, ic.n_gates);
+
+    return new Circuit(layout);
+}
+
+static void load_vars(const MappedFile *file, const ImageHeader *header,
+                      uint64_t offset, uint64_t n,
+                      std::vector<Variable> &vars)
+{
+    const ImageVar *image_vars = section<ImageVar>(file, offset, n);
+
+    for (uint64_t i = 0; i < n; i++) {
+        Variable var;
+        var.name = get_string(file, header, image_vars[i].name);
+        var.type = (VariableType) image_vars[i].type;
+
+        const ImageString *components =
+            section<ImageString>(file, image_vars[i].components,
+                                 image_vars[i].n_components);
+        for (uint64_t j = 0; j < image_vars[i].n_components; j++)
+            var.components.push_back(get_string(file, header,
+                                                 components[j]));
+        vars.push_back(var);
+    }
+}
+
+CompilerResult ProgramImage::load(const std::string &file_name)
+{
+    MappedFile *file = new MappedFile(file_name);
+    if (file->get_size() < sizeof(ImageHeader) ||
+        memcmp(file->get_data(), PROGRAM_IMAGE_MAGIC,
+               sizeof(ImageHeader::magic))) {
+        delete file;
+        throw "Not a program image";
+    }
+
+    const ImageHeader *header = section<ImageHeader>(file, 0, 1);
+    if (header->version != PROGRAM_IMAGE_VERSION ||
+        header->byte_order != PROGRAM_IMAGE_BYTE_ORDER) {
+        delete file;
+        throw "Program image was written by an incompatible version";
+    }
+    if (header->file_size != file->get_size()) {
+        delete file;
+        throw "Corrupt program image";
+    }
+
+    // From here on the program owns the mapping
+    compiler::SCDLProgram *prog = new compiler::SCDLProgram();
+    prog->image = file;
+
+    CompilerResult result;
+    try {
+        const ImageVariable *variables =
+            section<ImageVariable>(file, header->variables,
+                                   header->n_variables);
+        for (uint64_t i = 0; i < header->n_variables; i++) {
+            compiler::Variable var;
+            var.len = variables[i].len;
+            var.input_index = variables[i].input_index;
+            std::string name = get_string(file, header, variables[i].name);
+            prog->var_map[name] = var;
+            prog->var_names.push_back(name);
+            prog->n_var_inputs += var.len;
+        }
+
+        const ImageConstant *constants =
+            section<ImageConstant>(file, header->constants,
+                                   header->n_constants);
+        for (uint64_t i = 0; i < header->n_constants; i++) {
+            compiler::Constant c;
+            c.value = constants[i].value;
+            c.input_index = constants[i].input_index;
+            std::string name = get_string(file, header, constants[i].name);
+            prog->const_map[name] = c;
+            prog->const_names.push_back(name);
+        }
+
+        const ImageString *circuits =
+            section<ImageString>(file, header->circuits, header->n_circuits);
+        for (uint64_t i = 0; i < header->n_circuits; i++) {
+            std::string name = get_string(file, header, circuits[i]);
+            prog->output_of[name] = i;
+            prog->circuit_names.push_back(name);
+        }
+
+        if (header->pool != 0) {
+            const ImageCircuit *pool = section<ImageCircuit>(file,
+                                                             header->pool, 1);
+            if (pool->n_outputs != header->n_circuits)
+                throw "Corrupt program image";
+            prog->gate_pool = load_circuit(file, *pool);
+        }
+        else if (header->n_circuits != 0)
+            throw "Corrupt program image";
+
+        // Parents come first, so that chains of call sites end
+        Provenance &provenance = prog->provenance;
+        const ImageString *function_names =
+            section<ImageString>(file, header->function_names,
+                                 header->n_function_names);
+        for (uint64_t i = 0; i < header->n_function_names; i++)
+            provenance.function_names.push_back(
+                get_string(file, header, function_names[i]));
+
+        const ImageCallSite *call_sites =
+            section<ImageCallSite>(file, header->call_sites,
+                                   header->n_call_sites);
+        for (uint64_t i = 0; i < header->n_call_sites; i++) {
+            CallSite site = {call_sites[i].function, call_sites[i].parent};
+            if (site.function >= header->n_function_names ||
+                (site.parent != NO_ORIGIN && site.parent >= i))
+                throw "Corrupt program image";
+            provenance.call_sites.push_back(site);
+        }
+
+        OptimizeStats &stats = prog->optimize_stats;
+        stats.depth_before = header->depth_before;
+        stats.depth_after = header->depth_after;
+        stats.n_mult_before = header->n_mult_before;
+        stats.n_mult_after = header->n_mult_after;
+        stats.n_add_before = header->n_add_before;
+        stats.n_add_after = header->n_add_after;
+
+        load_vars(file, header, header->vars_inputs, header->n_vars_inputs,
+                  result.vars.inputs);
+        load_vars(file, header, header->vars_outputs,
+                  header->n_vars_outputs, result.vars.outputs);
+    }
+    catch (const char *) {
+        delete prog;
+        throw;
+    }
+
+    result.program = prog;
+
+    return result;
+}
+
+bool ProgramImage::is_image(const std::string &file_name)
+{
+    char magic[8];
+    std::ifstream in(file_name.c_str(), std::ios::binary);
+
+    if (!in.read(magic, sizeof(magic)))
+        return false;
+
+    return memcmp(magic, PROGRAM_IMAGE_MAGIC, sizeof(magic)) == 0;
+}
+
+}
@@ -0,0 +1,149 @@
+#ifndef PROGRAM_IMAGE_H
+#define PROGRAM_IMAGE_H
+
+#include <string>
+#include <cstdlib>
+#include <stdint.h>
+
+#include "SCDLProgram.h"
+#include "SCDLEvaluator.h"
+#include "MappedFile.h"
+
+namespace scdl {
+
+/* First bytes of every program image */
+#define PROGRAM_IMAGE_MAGIC "SCDLIMG"
+
+/* Bumped whenever the layout of an image changes */
+#define PROGRAM_IMAGE_VERSION 4
+
+/* Written as is, so an image from a host of other byte order is refused */
+#define PROGRAM_IMAGE_BYTE_ORDER 0x01020304
+
+/*
+ * On-disk layout of a program image. Every field is a fixed-width integer
+ * and every section starts at an offset from the beginning of the file that
+ * is a multiple of 8, so the structures and the gate arrays of the circuits
+ * are used in place from a mapping of the file.
+ */
+struct ImageString {
+    uint64_t offset;        // in the string table
+    uint64_t len;
+};
+
+struct ImageHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t file_size;
+
+    uint64_t strings;       // string table
+    uint64_t n_string_bytes;
+    uint64_t variables;     // ImageVariable[n_variables], sorted by name
+    uint64_t n_variables;
+    uint64_t constants;     // ImageConstant[n_constants], sorted by name
+    uint64_t n_constants;
+    uint64_t circuits;      // ImageString[n_circuits], function names
+    uint64_t n_circuits;
+    uint64_t pool;          // ImageCircuit, 0 if there are no functions
+    uint64_t vars_inputs;   // ImageVar[n_vars_inputs]
+    uint64_t n_vars_inputs;
+    uint64_t vars_outputs;  // ImageVar[n_vars_outputs]
+    uint64_t n_vars_outputs;
+    uint64_t function_names;    // ImageString[n_function_names]
+    uint64_t n_function_names;
+    uint64_t call_sites;    // ImageCallSite[n_call_sites]
+    uint64_t n_call_sites;
+
+    int64_t depth_before;   // OptimizeStats of the compilation
+    int64_t depth_after;
+    uint64_t n_mult_before;
+    uint64_t n_mult_after;
+    uint64_t n_add_before;
+    uint64_t n_add_after;
+};
+
+struct ImageVariable {
+    ImageString name;
+    uint64_t len;
+    uint64_t input_index;
+};
+
+struct ImageConstant {
+    ImageString name;
+    int64_t value;
+    uint64_t input_index;
+};
+
+/* A CircuitLayout, the arrays given as offsets */
+struct ImageCircuit {
+    uint64_t n_inputs;
+    uint64_t n_add_gates;
+    uint64_t n_mult_gates;
+    uint64_t n_slots;
+    int64_t mult_depth;
+    uint64_t binary;
+    uint64_t n_gates;
+    uint64_t n_operands;
+    uint64_t n_outputs;
+    uint64_t n_levels;
+    uint64_t gate_types;
+    uint64_t operand_offsets;   // 0 if binary
+    uint64_t operands;
+    uint64_t output_gate_indices;
+    uint64_t level_offsets;
+    uint64_t level_gates;
+    uint64_t slot_of;
+    uint64_t origins;   // 0 if the gates have none
+};
+
+/* A CallSite of the Provenance of the program */
+struct ImageCallSite {
+    uint32_t function;
+    uint32_t parent;
+};
+
+/* A variable of the .vars metadata */
+struct ImageVar {
+    ImageString name;
+    uint64_t type;
+    uint64_t components;    // ImageString[n_components]
+    uint64_t n_components;
+};
+
+/*
+ * Versioned binary form of a compiled SCDLProgram and its .vars metadata.
+ *
+ * An image holds the variable and constant tables, the names of the
+ * functions and the gate pool (the circuit over all the functions, whose
+ * outputs they are). These are the functions the program kept (see
+ * CompileOptions::outputs), so an image written by eval only has those of
+ * the output wires of its .vars metadata. A loaded program evaluates functions on the pool over
+ * their cones, as a compiled one does. The origins of the gates are kept
+ * with the Provenance of the program, so costs can be reported for a
+ * loaded one.
+ *
+ * Loading maps the file read-only and constructs the circuits over the
+ * mapping: no parsing, no gate is copied or checked, and allocations only
+ * happen per symbol and per circuit. Any number of processes loading the
+ * same image share its pages. The layout of the image is checked when it is
+ * loaded, but gate indices are trusted like those of the program the image
+ * was written from.
+ */
+class ProgramImage {
+ public:
+    /* vars may be NULL */
+    static void save(const compiler::SCDLProgram *prog, const Vars *vars,
+                     const std::string &file_name);
+    //       throws const char *;
+
+    static CompilerResult load(const std::string &file_name);
+    //       throws const char *;
+
+    /* True if the file starts with the image magic */
+    static bool is_image(const std::string &file_name);
+};
+
+}
+
+#endif // PROGRAM_IMAGE_H
@@ -0,0 +1,127 @@
+#include "Provenance.h"
+
+#include <algorithm>
+#include <iomanip>
+
+namespace scdl {
+
+static bool more_costly(const FunctionCost &a, const FunctionCost &b)
+{
+    if (a.n_mult_inclusive != b.n_mult_inclusive)
+        return a.n_mult_inclusive > b.n_mult_inclusive;
+    if (a.n_add_inclusive != b.n_add_inclusive)
+        return a.n_add_inclusive > b.n_add_inclusive;
+    return a.name < b.name;
+}
+
+CostReport::CostReport(const Circuit *circuit, const Provenance &provenance,
+                       const CircuitCone *cone)
+    : circuit(circuit), provenance(provenance)
+{
+    // The last row is for the gates without a known origin
+    size_t n_functions = provenance.function_names.size();
+    std::vector<FunctionCost> all(n_functions + 1);
+    for (size_t f = 0; f < n_functions; f++)
+        all[f].name = provenance.function_names[f];
+    all[n_functions].name = "<unknown>";
+
+    std::vector<bool> site_seen(provenance.call_sites.size(), false);
+    std::vector<unsigned int> functions;
+    size_t n_gates = (cone != NULL) ? cone->get_num_gates() :
+                                      circuit->get_num_gates();
+    for (size_t k = 0; k < n_gates; k++) {
+        unsigned int i = (cone != NULL) ? cone->get_gate_index(k) : k;
+        GateType type = circuit->get_gate_type(i);
+        if (type != GATE_MULT && type != GATE_ADD)
+            continue;
+
+        unsigned int site = circuit->get_origin(i);
+        functions.clear();
+        add_chain(site, functions);
+        if (functions.empty())
+            functions.push_back(n_functions);
+
+        // The callers of a site that was seen have been counted with it
+        for (; site < site_seen.size() && !site_seen[site];
+             site = provenance.call_sites[site].parent) {
+            site_seen[site] = true;
+            unsigned int f = provenance.call_sites[site].function;
+            if (f < n_functions)
+                all[f].n_call_sites++;
+        }
+
+        FunctionCost &own = all[functions[0]];
+        if (type == GATE_MULT)
+            own.n_mult++;
+        else
+            own.n_add++;
+        for (size_t k = 0; k < functions.size(); k++) {
+            if (type == GATE_MULT)
+                all[functions[k]].n_mult_inclusive++;
+            else
+                all[functions[k]].n_add_inclusive++;
+        }
+    }
+
+    CircuitStats stats(circuit, cone);
+    const std::vector<unsigned int> &path = stats.get_critical_path();
+    for (size_t i = 0; i < path.size(); i++) {
+        functions.clear();
+        add_chain(circuit->get_origin(path[i]), functions);
+        if (functions.empty())
+            functions.push_back(n_functions);
+        all[functions[0]].depth++;
+        for (size_t k = 0; k < functions.size(); k++)
+            all[functions[k]].depth_inclusive++;
+    }
+
+    for (size_t f = 0; f < all.size(); f++) {
+        if (all[f].n_mult_inclusive + all[f].n_add_inclusive > 0)
+            costs.push_back(all[f]);
+    }
+    std::sort(costs.begin(), costs.end(), more_costly);
+}
+
+/*
+ * Appends the function of a call site and those of its callers, each once.
+ * Nothing is appended for an origin that is not a call site.
+ */
+void CostReport::add_chain(unsigned int site,
+                           std::vector<unsigned int> &functions) const
+{
+    const std::vector<CallSite> &sites = provenance.call_sites;
+
+    while (site < sites.size()) {
+        unsigned int f = sites[site].function;
+        if (f < provenance.function_names.size() &&
+            std::find(functions.begin(), functions.end(), f) ==
+            functions.end())
+            functions.push_back(f);
+        site = sites[site].parent;
+    }
+}
+
+void CostReport::print(std::ostream &out) const
+{
+    size_t width = 8;
+    for (size_t i = 0; i < costs.size(); i++)
+        width = std::max(width, costs[i].name.size());
+
+    out << std::left << std::setw(width) << "function" << std::right
+        << std::setw(7) << "calls"
+        << std::setw(10) << "mult" << std::setw(10) << "mult+"
+        << std::setw(10) << "add" << std::setw(10) << "add+"
+        << std::setw(7) << "depth" << std::setw(7) << "depth+" << std::endl;
+
+    for (size_t i = 0; i < costs.size(); i++) {
+        const FunctionCost &c = costs[i];
+        out << std::left << std::setw(width) << c.name << std::right
+            << std::setw(7) << c.n_call_sites
+            << std::setw(10) << c.n_mult << std::setw(10) << c.n_mult_inclusive
+            << std::setw(10) << c.n_add << std::setw(10) << c.n_add_inclusive
+            << std::setw(7) << c.depth << std::setw(7) << c.depth_inclusive
+            << std::endl;
+    }
+}
+
+}
@@ -0,0 +1,91 @@
+#ifndef PROVENANCE_H
+#define PROVENANCE_H
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <cstdlib>
+
+#include "Circuit.h"
+
+namespace scdl {
+
+/*
+ * An instantiation of an SCDL function: the evaluation of a function
+ * without parameters, or a call with a new set of arguments (calls with the
+ * same arguments share the instance, see instantiate_function). parent is
+ * the call site whose body contains the call, NO_ORIGIN at the top.
+ */
+struct CallSite {
+    unsigned int function;  // index in Provenance::function_names
+    unsigned int parent;    // index in Provenance::call_sites, or NO_ORIGIN
+};
+
+/*
+ * What the origins of the gates (see Gate) refer to. A parent always comes
+ * before its call sites.
+ */
+struct Provenance {
+    std::vector<std::string> function_names;    // in order of definition
+    std::vector<CallSite> call_sites;
+
+    bool empty() const {
+        return call_sites.empty();
+    }
+};
+
+/*
+ * Cost of a function in a circuit. The exclusive counts are the gates that
+ * the body of the function created itself; the inclusive ones add those of
+ * the functions it called, directly or not. The depth is the number of
+ * GATE_MULT of the function on the critical path of the circuit (see
+ * CircuitStats), so the exclusive depths add up to its multiplicative depth.
+ */
+struct FunctionCost {
+    FunctionCost()
+        : n_call_sites(0), n_mult(0), n_mult_inclusive(0), n_add(0),
+          n_add_inclusive(0), depth(0), depth_inclusive(0) {}
+
+    std::string name;
+    size_t n_call_sites;    // instantiations that led to gates of the circuit
+    size_t n_mult;
+    size_t n_mult_inclusive;
+    size_t n_add;
+    size_t n_add_inclusive;
+    int depth;
+    int depth_inclusive;
+};
+
+/*
+ * Attributes the gates of a circuit to the SCDL functions that created
+ * them. Gates the optimizer rewrote count for the function of the gate they
+ * replace; a gate shared by several call sites, through hash-consing, for
+ * the first one that created it. Gates without a known origin are
+ * reported under "<unknown>". Given a cone of the circuit, only its gates
+ * are attributed.
+ */
+class CostReport {
+ public:
+    CostReport(const Circuit *circuit, const Provenance &provenance,
+               const CircuitCone *cone=NULL);
+
+    /* Functions with gates in the circuit, by decreasing inclusive cost */
+    const std::vector<FunctionCost> &get_costs() const {
+        return costs;
+    }
+
+    /* Aligned table of get_costs() */
+    void print(std::ostream &out) const;
+
+ private:
+    void add_chain(unsigned int site, std::vector<unsigned int> &functions)
+        const;
+
+    const Circuit *circuit;
+    const Provenance &provenance;
+    std::vector<FunctionCost> costs;
+};
+
+}
+
+#endif // PROVENANCE_H
@@ -0,0 +1,676 @@
+#include "Rewrite.h"
+
+#include <algorithm>
+
+namespace scdl {
+
+/* Largest number of cuts kept for a gate, besides the trivial cut */
+#define MAX_CUTS 8
+
+/*
+ * Implementation of a function of n variables with at most two ANDs. The
+ * masks select the generators that are XORed together to form an operand
+ * or the output: bits 0 to 3 are the variables, bit 4 the first AND, bit 5
+ * the second AND and bit 6 the constant one.
+ */
+struct XagImpl {
+    int n_and;      // -1 if the function needs more than two ANDs
+    unsigned char and_in[2][2];
+    unsigned char out;
+};
+
+#define GEN_AND0  4
+#define GEN_AND1  5
+#define GEN_ONE   6
+#define N_GENS    7
+
+/* Truth table of variable k of a function of n variables */
+static unsigned int var_table(int k, int n)
+{
+    unsigned int t = 0;
+    for (int j = 0; j < (1 << n); j++) {
+        if ((j >> k) & 1)
+            t |= 1u << j;
+    }
+    return t;
+}
+
+/* Truth tables of all XORs of generators, indexed by mask */
+static void mask_tables(const unsigned int *gens, unsigned int *tables)
+{
+    tables[0] = 0;
+    for (unsigned int m = 1; m < (1u << N_GENS); m++) {
+        int low = __builtin_ctz(m);
+        tables[m] = tables[m & (m - 1)] ^ gens[low];
+    }
+}
+
+/*
+ * Finds an implementation with the least number of ANDs for every function
+ * of n variables that has one with at most two ANDs. Functions are tried
+ * in order of AND count, so the first implementation found is minimal.
+ */
+static void build_database(int n, std::vector<XagImpl> &db)
+{
+    size_t size = (size_t) 1 << (1 << n);
+    unsigned int full = (unsigned int) (size - 1);
+    XagImpl none = {-1, {{0, 0}, {0, 0}}, 0};
+    db.assign(size, none);
+
+    unsigned int gens[N_GENS] = {0};
+    for (int k = 0; k < n; k++)
+        gens[k] = var_table(k, n);
+    gens[GEN_ONE] = full;
+
+    std::vector<unsigned char> affine;
+    std::vector<unsigned char> linear;
+    for (unsigned int m = 0; m < (1u << n); m++) {
+        affine.push_back(m);
+        affine.push_back(m | (1 << GEN_ONE));
+        if (m != 0) {
+            linear.push_back(m);
+            linear.push_back(m | (1 << GEN_ONE));
+        }
+    }
+
+    unsigned int tables[1 << N_GENS];
+    mask_tables(gens, tables);
+
+    for (size_t i = 0; i < affine.size(); i++) {
+        XagImpl &impl = db[tables[affine[i]]];
+        if (impl.n_and < 0) {
+            impl.n_and = 0;
+            impl.out = affine[i];
+        }
+    }
+
+    // One AND of two non-constant affine functions
+    std::vector<bool> seen(size, false);
+    std::vector<std::pair<unsigned char,unsigned char> > and0;
+    std::vector<unsigned int> and0_table;
+    for (size_t i = 0; i < linear.size(); i++) {
+        for (size_t j = i + 1; j < linear.size(); j++) {
+            unsigned int a = tables[linear[i]] & tables[linear[j]];
+            if (seen[a])
+                continue;
+            seen[a] = true;
+            and0.push_back(std::make_pair(linear[i], linear[j]));
+            and0_table.push_back(a);
+        }
+    }
+
+    for (size_t t = 0; t < and0.size(); t++) {
+        for (size_t i = 0; i < affine.size(); i++) {
+            XagImpl &impl = db[and0_table[t] ^ tables[affine[i]]];
+            if (impl.n_and < 0) {
+                impl.n_and = 1;
+                impl.and_in[0][0] = and0[t].first;
+                impl.and_in[0][1] = and0[t].second;
+                impl.out = affine[i] | (1 << GEN_AND0);
+            }
+        }
+    }
+
+    // A second AND whose operands may use the first one
+    std::vector<unsigned char> operands;
+    for (size_t i = 0; i < linear.size(); i++)
+        operands.push_back(linear[i]);
+    for (size_t i = 0; i < affine.size(); i++)
+        operands.push_back(affine[i] | (1 << GEN_AND0));
+
+    for (size_t t = 0; t < and0.size(); t++) {
+        gens[GEN_AND0] = and0_table[t];
+        mask_tables(gens, tables);
+        std::fill(seen.begin(), seen.end(), false);
+
+        for (size_t i = 0; i < operands.size(); i++) {
+            for (size_t j = i + 1; j < operands.size(); j++) {
+                unsigned int a = tables[operands[i]] & tables[operands[j]];
+                if (seen[a])
+                    continue;
+                seen[a] = true;
+
+                for (int with_and0 = 0; with_and0 < 2; with_and0++) {
+                    unsigned int base = a ^ (with_and0 ? and0_table[t] : 0);
+                    for (size_t k = 0; k < affine.size(); k++) {
+                        XagImpl &impl = db[base ^ tables[affine[k]]];
+                        if (impl.n_and >= 0)
+                            continue;
+                        impl.n_and = 2;
+                        impl.and_in[0][0] = and0[t].first;
+                        impl.and_in[0][1] = and0[t].second;
+                        impl.and_in[1][0] = operands[i];
+                        impl.and_in[1][1] = operands[j];
+                        impl.out = affine[k] | (1 << GEN_AND1) |
+                                   (with_and0 ? (1 << GEN_AND0) : 0);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* Database for each number of variables, built on first use */
+static const std::vector<XagImpl> &xag_database(int n)
+{
+    struct Databases {
+        Databases() {
+            for (int k = 0; k <= CUT_SIZE; k++)
+                build_database(k, db[k]);
+        }
+        std::vector<XagImpl> db[CUT_SIZE + 1];
+    };
+    static const Databases databases;
+
+    return databases.db[n];
+}
+
+
+XagRewriter::XagRewriter(Arena &arena,
+                         const std::map<Gate*,int> &constant_gates)
+    : arena(arena), constant_gates(constant_gates), current_origin(NO_ORIGIN)
+{
+    constant_nodes[0] = -1;
+    constant_nodes[1] = -1;
+}
+
+void XagRewriter::run(std::map<std::string,Gate*> &func_gates)
+{
+    std::map<Gate*,int> imported;
+    std::map<std::string,int> outputs;
+    std::map<std::string,Gate*>::iterator itr;
+    for (itr = func_gates.begin(); itr != func_gates.end(); itr++)
+        outputs[itr->first] = import_gate(itr->second, imported);
+
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].type == GATE_IN)
+            continue;
+        nodes[nodes[i].in[0]].refs++;
+        nodes[nodes[i].in[1]].refs++;
+    }
+    std::map<std::string,int>::iterator oitr;
+    for (oitr = outputs.begin(); oitr != outputs.end(); oitr++)
+        nodes[oitr->second].refs++;
+
+    // Nodes are in topological order. Gates added by a rewrite come after
+    // the original ones and are not rewritten again.
+    size_t n_original = nodes.size();
+    for (size_t i = 0; i < n_original; i++) {
+        if (nodes[i].type == GATE_IN || nodes[i].refs == 0)
+            continue;
+
+        // Inputs that have been replaced since this node was created
+        int in0 = resolve(nodes[i].in[0]);
+        int in1 = resolve(nodes[i].in[1]);
+        if (in0 != nodes[i].in[0] || in1 != nodes[i].in[1]) {
+            erase_key(i);
+            nodes[i].in[0] = in0;
+            nodes[i].in[1] = in1;
+
+            std::pair<GateType,std::pair<int,int> > key(nodes[i].type,
+                std::make_pair(std::min(in0, in1), std::max(in0, in1)));
+            std::map<std::pair<GateType,std::pair<int,int> >,int>::iterator
+                titr = table.find(key);
+            if (titr != table.end()) {
+                replace(i, titr->second);
+                continue;
+            }
+            table[key] = i;
+        }
+
+        rewrite_node(i);
+    }
+
+    std::vector<Gate*> emitted(nodes.size(), NULL);
+    for (oitr = outputs.begin(); oitr != outputs.end(); oitr++)
+        func_gates[oitr->first] = emit(resolve(oitr->second), emitted);
+}
+
+/*
+ * Post-order import, so that the node vector is topologically sorted. The
+ * walk uses an explicit stack as the graph may be deep.
+ */
+int XagRewriter::import_gate(Gate *gate, std::map<Gate*,int> &imported)
+{
+    std::map<Gate*,int>::iterator itr = imported.find(gate);
+    if (itr != imported.end())
+        return itr->second;
+
+    struct Frame {
+        Gate *gate;
+        size_t next;    // operand to import next
+        int n;          // node of the operands imported so far
+    };
+    Frame root = {gate, 0, -1};
+    std::vector<Frame> stack(1, root);
+
+    while (!stack.empty()) {
+        Frame &frame = stack.back();
+        Gate *g = frame.gate;
+
+        if (g->type == GATE_IN) {
+            Node node = {GATE_IN, {-1, -1}, 0, -1, -1, g, NO_ORIGIN};
+            std::map<Gate*,int>::const_iterator citr =
+                constant_gates.find(g);
+            if (citr != constant_gates.end())
+                node.constant = citr->second % 2 != 0;
+            int n = nodes.size();
+            nodes.push_back(node);
+            if (node.constant >= 0 && constant_nodes[node.constant] < 0)
+                constant_nodes[node.constant] = n;
+
+            imported[g] = n;
+            stack.pop_back();
+            continue;
+        }
+
+        if (frame.next < g->fan_in) {
+            Gate *in = g->in_gates[frame.next];
+            itr = imported.find(in);
+            if (itr == imported.end()) {
+                Frame in_frame = {in, 0, -1};
+                stack.push_back(in_frame);
+                continue;
+            }
+
+            // Gates with more than two inputs become chains of binary nodes
+            if (frame.next == 0)
+                frame.n = itr->second;
+            else {
+                current_origin = g->origin;
+                frame.n = make_node(g->type, frame.n, itr->second);
+            }
+            frame.next++;
+            continue;
+        }
+
+        if (g->fan_in == 2 && nodes[frame.n].gate == NULL)
+            nodes[frame.n].gate = g;
+        imported[g] = frame.n;
+        stack.pop_back();
+    }
+
+    return imported[gate];
+}
+
+int XagRewriter::make_node(GateType type, int left, int right)
+{
+    std::pair<GateType,std::pair<int,int> > key(type,
+        std::make_pair(std::min(left, right), std::max(left, right)));
+    std::map<std::pair<GateType,std::pair<int,int> >,int>::iterator itr =
+        table.find(key);
+    if (itr != table.end())
+        return itr->second;
+
+    Node node = {type, {left, right}, 0, -1, -1, NULL, current_origin};
+    int n = nodes.size();
+    nodes.push_back(node);
+    table[key] = n;
+
+    return n;
+}
+
+/* Node of a constant input with the given value, or -1 if there is none */
+int XagRewriter::constant_node(int value)
+{
+    if (constant_nodes[value] >= 0)
+        return constant_nodes[value];
+
+    std::map<Gate*,int>::const_iterator itr;
+    for (itr = constant_gates.begin(); itr != constant_gates.end(); itr++) {
+        if ((itr->second % 2 != 0) == value) {
+            Node node = {GATE_IN, {-1, -1}, 0, -1, value, itr->first,
+                         NO_ORIGIN};
+            constant_nodes[value] = nodes.size();
+            nodes.push_back(node);
+            break;
+        }
+    }
+
+    return constant_nodes[value];
+}
+
+int XagRewriter::resolve(int n) const
+{
+    while (nodes[n].replaced >= 0)
+        n = nodes[n].replaced;
+    return n;
+}
+
+/*
+ * Cuts of a node, from merging the cuts of its inputs. Constants have a
+ * single cut with no leaves, so they never take the place of a variable.
+ * The nodes below n are given their cuts first, in post-order with an
+ * explicit stack as the graph may be deep.
+ */
+const std::vector<XagRewriter::Cut> &XagRewriter::get_cuts(int n)
+{
+    if (cuts.size() < nodes.size()) {
+        cuts.resize(nodes.size());
+        has_cuts.resize(nodes.size(), false);
+    }
+
+    std::vector<int> stack;
+    if (!has_cuts[n])
+        stack.push_back(n);
+    while (!stack.empty()) {
+        int m = stack.back();
+        if (has_cuts[m]) {
+            stack.pop_back();
+            continue;
+        }
+
+        bool ready = true;
+        if (nodes[m].type != GATE_IN) {
+            for (int k = 1; k >= 0; k--) {
+                if (!has_cuts[nodes[m].in[k]]) {
+                    stack.push_back(nodes[m].in[k]);
+                    ready = false;
+                }
+            }
+        }
+        if (ready) {
+            merge_cuts(m);
+            stack.pop_back();
+        }
+    }
+
+    return cuts[n];
+}
+
+/* Sets the cuts of n, those of its inputs being known */
+void XagRewriter::merge_cuts(int n)
+{
+    std::vector<Cut> result;
+    Cut trivial;
+    trivial.n_leaves = 1;
+    trivial.leaves[0] = n;
+
+    if (nodes[n].type == GATE_IN) {
+        if (nodes[n].constant >= 0)
+            trivial.n_leaves = 0;
+        result.push_back(trivial);
+    }
+    else {
+        const std::vector<Cut> &left = cuts[nodes[n].in[0]];
+        const std::vector<Cut> &right = cuts[nodes[n].in[1]];
+
+        for (size_t i = 0; i < left.size(); i++) {
+            for (size_t j = 0; j < right.size(); j++) {
+                const Cut &a = left[i];
+                const Cut &b = right[j];
+                int merged[2 * CUT_SIZE];
+                int n_merged = std::set_union(a.leaves, a.leaves + a.n_leaves,
+                                              b.leaves, b.leaves + b.n_leaves,
+                                              merged) - merged;
+                if (n_merged > CUT_SIZE)
+                    continue;
+
+                Cut cut;
+                cut.n_leaves = n_merged;
+                std::copy(merged, merged + n_merged, cut.leaves);
+
+                bool duplicate = false;
+                for (size_t k = 0; k < result.size() && !duplicate; k++) {
+                    duplicate = result[k].n_leaves == cut.n_leaves &&
+                                std::equal(cut.leaves,
+                                           cut.leaves + cut.n_leaves,
+                                           result[k].leaves);
+                }
+                if (!duplicate)
+                    result.push_back(cut);
+            }
+        }
+
+        // Prefer the smaller cuts
+        for (size_t i = 1; i < result.size(); i++) {
+            for (size_t j = i; j > 0 &&
+                 result[j].n_leaves < result[j - 1].n_leaves; j--)
+                std::swap(result[j], result[j - 1]);
+        }
+        if (result.size() > MAX_CUTS)
+            result.resize(MAX_CUTS);
+        result.push_back(trivial);
+    }
+
+    cuts[n] = result;
+    has_cuts[n] = true;
+}
+
+/* Truth table of node n over the leaves of cut */
+unsigned int XagRewriter::cut_function(int n, const Cut &cut,
+                                       std::map<int,unsigned int> &values) const
+{
+    std::map<int,unsigned int>::iterator itr = values.find(n);
+    if (itr != values.end())
+        return itr->second;
+
+    const Node &node = nodes[n];
+    unsigned int full = (1u << (1 << cut.n_leaves)) - 1;
+    unsigned int value;
+
+    if (node.type == GATE_IN) {
+        if (node.constant < 0)
+            throw "Cut does not cover the gate";
+        value = node.constant ? full : 0;
+    }
+    else {
+        unsigned int a = cut_function(node.in[0], cut, values);
+        unsigned int b = cut_function(node.in[1], cut, values);
+        value = (node.type == GATE_MULT) ? (a & b) : (a ^ b);
+    }
+
+    values[n] = value;
+    return value;
+}
+
+void XagRewriter::rewrite_node(int n)
+{
+    const std::vector<Cut> &node_cuts = get_cuts(n);
+    int best_gain = 0;
+    Cut best_cut;
+    unsigned int best_function = 0;
+
+    for (size_t c = 0; c < node_cuts.size(); c++) {
+        const Cut &cut = node_cuts[c];
+        if (cut.n_leaves == 1 && cut.leaves[0] == n)
+            continue;
+
+        std::map<int,unsigned int> values;
+        for (int k = 0; k < cut.n_leaves; k++)
+            values[cut.leaves[k]] = var_table(k, cut.n_leaves);
+        unsigned int function = cut_function(n, cut, values);
+
+        const XagImpl &impl = xag_database(cut.n_leaves)[function];
+        if (impl.n_and < 0)
+            continue;
+
+        // Gates that would be left without users, keeping the leaves
+        for (int k = 0; k < cut.n_leaves; k++)
+            nodes[cut.leaves[k]].refs++;
+        int saved = (nodes[n].type == GATE_MULT) + deref_rec(n, false);
+        ref_rec(n);
+        for (int k = 0; k < cut.n_leaves; k++)
+            nodes[cut.leaves[k]].refs--;
+
+        if (saved - impl.n_and > best_gain) {
+            best_gain = saved - impl.n_and;
+            best_cut = cut;
+            best_function = function;
+        }
+    }
+
+    if (best_gain > 0) {
+        // The implementation takes the origin of the node it replaces
+        current_origin = nodes[n].origin;
+        int r = build_impl(best_cut, best_function);
+        if (r >= 0 && r != n)
+            replace(n, r);
+    }
+}
+
+/* Returns the root of the implementation, or -1 if a constant is missing */
+int XagRewriter::build_impl(const Cut &cut, unsigned int function)
+{
+    const XagImpl &impl = xag_database(cut.n_leaves)[function];
+
+    int gens[N_GENS];
+    std::fill(gens, gens + N_GENS, -1);
+    std::copy(cut.leaves, cut.leaves + cut.n_leaves, gens);
+    gens[GEN_ONE] = constant_node(1);
+
+    for (int k = 0; k < impl.n_and; k++) {
+        int a = build_xor(impl.and_in[k][0], gens);
+        int b = build_xor(impl.and_in[k][1], gens);
+        if (a < 0 || b < 0)
+            return -1;
+        gens[GEN_AND0 + k] = make_node(GATE_MULT, a, b);
+    }
+
+    return build_xor(impl.out, gens);
+}
+
+int XagRewriter::build_xor(unsigned int mask, const int *generators)
+{
+    if (mask == 0)
+        return constant_node(0);
+
+    int n = -1;
+    for (int k = 0; k < N_GENS; k++) {
+        if (!((mask >> k) & 1))
+            continue;
+        if (generators[k] < 0)
+            return -1;
+        n = (n < 0) ? generators[k] : make_node(GATE_ADD, n, generators[k]);
+    }
+
+    return n;
+}
+
+/* Moves the users of n over to r and frees the gates only n used */
+void XagRewriter::replace(int n, int r)
+{
+    if (nodes[r].refs == 0)
+        ref_rec(r);
+    nodes[r].refs += nodes[n].refs;
+    nodes[n].refs = 0;
+    nodes[n].replaced = r;
+
+    erase_key(n);
+    deref_rec(n, true);
+}
+
+/*
+ * Counts a reference from every input of n, and from the inputs of the
+ * nodes that thereby get their first user. The recursion is on an explicit
+ * stack, as are those of deref_rec and emit, because the graph may be deep.
+ */
+void XagRewriter::ref_rec(int n)
+{
+    std::vector<int> stack(1, n);
+    while (!stack.empty()) {
+        int m = stack.back();
+        stack.pop_back();
+        if (nodes[m].type == GATE_IN)
+            continue;
+
+        for (int k = 0; k < 2; k++) {
+            if (nodes[nodes[m].in[k]].refs++ == 0)
+                stack.push_back(nodes[m].in[k]);
+        }
+    }
+}
+
+/* Returns the number of ANDs among the nodes left without users */
+int XagRewriter::deref_rec(int n, bool remove)
+{
+    int saved = 0;
+    std::vector<int> stack(1, n);
+    while (!stack.empty()) {
+        int m = stack.back();
+        stack.pop_back();
+        if (nodes[m].type == GATE_IN)
+            continue;
+
+        for (int k = 0; k < 2; k++) {
+            int in = nodes[m].in[k];
+            if (--nodes[in].refs == 0 && nodes[in].type != GATE_IN) {
+                if (remove)
+                    erase_key(in);
+                saved += nodes[in].type == GATE_MULT;
+                stack.push_back(in);
+            }
+        }
+    }
+
+    return saved;
+}
+
+void XagRewriter::erase_key(int n)
+{
+    if (nodes[n].type == GATE_IN)
+        return;
+
+    std::pair<GateType,std::pair<int,int> > key(nodes[n].type,
+        std::make_pair(std::min(nodes[n].in[0], nodes[n].in[1]),
+                       std::max(nodes[n].in[0], nodes[n].in[1])));
+    std::map<std::pair<GateType,std::pair<int,int> >,int>::iterator itr =
+        table.find(key);
+    if (itr != table.end() && itr->second == n)
+        table.erase(itr);
+}
+
+/* Gate for a node, keeping the original gate where nothing changed */
+Gate *XagRewriter::emit(int n, std::vector<Gate*> &emitted)
+{
+    if (emitted.size() < nodes.size())
+        emitted.resize(nodes.size(), NULL);
+
+    std::vector<int> stack;
+    if (emitted[n] == NULL)
+        stack.push_back(n);
+    while (!stack.empty()) {
+        int m = stack.back();
+        Node &node = nodes[m];
+        if (emitted[m] != NULL) {
+            stack.pop_back();
+            continue;
+        }
+        if (node.type == GATE_IN) {
+            emitted[m] = node.gate;
+            stack.pop_back();
+            continue;
+        }
+
+        // The inputs are emitted first, the left one before the right one
+        if (emitted[node.in[0]] == NULL || emitted[node.in[1]] == NULL) {
+            if (emitted[node.in[1]] == NULL)
+                stack.push_back(node.in[1]);
+            if (emitted[node.in[0]] == NULL)
+                stack.push_back(node.in[0]);
+            continue;
+        }
+        stack.pop_back();
+
+        Gate *left = emitted[node.in[0]];
+        Gate *right = emitted[node.in[1]];
+        Gate *gate;
+        if (node.gate != NULL && node.gate->in_gates[0] == left &&
+            node.gate->in_gates[1] == right)
+            gate = node.gate;
+        else {
+            Gate *operands[2] = {left, right};
+            gate = made_gates.find(node.type, operands, 2);
+            if (gate == NULL) {
+                gate = arena.new_operator_gate(node.type, left, right);
+                gate->origin = node.origin;
+                made_gates.insert(node.type, operands, 2, gate);
+            }
+        }
+        emitted[m] = gate;
+    }
+
+    return emitted[n];
+}
+
+}
@@ -0,0 +1,84 @@
+#ifndef REWRITE_H
+#define REWRITE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdlib>
+
+#include "Circuit.h"
+#include "GateTable.h"
+#include "Arena.h"
+
+namespace scdl {
+
+/* Largest number of leaves of a cut */
+#define CUT_SIZE 4
+
+/*
+ * Cut-based rewriting that reduces the number of GATE_MULT gates. The gate
+ * graph is read as a XOR-AND graph over GF(2) (GATE_MULT is AND, GATE_ADD
+ * is XOR). For every gate the cuts of at most CUT_SIZE leaves are
+ * enumerated, and the function of the gate over the leaves of a cut is
+ * looked up in a database of implementations with the least number of ANDs
+ * (built once, on first use, by exhaustive search over XOR-AND circuits of
+ * up to two ANDs). The gate is replaced when that saves more ANDs than the
+ * implementation adds, taking into account the gates that stay alive
+ * because of other users.
+ */
+class XagRewriter {
+ public:
+    /* constant_gates maps the input gates of constants to their value */
+    XagRewriter(Arena &arena,
+                const std::map<Gate*,int> &constant_gates);
+
+    /* Rewrites the output gate of every function in place */
+    void run(std::map<std::string,Gate*> &func_gates);
+
+ private:
+    struct Node {
+        GateType type;
+        int in[2];
+        int refs;
+        int replaced;   // node that replaced this one, or -1
+        int constant;   // value of a constant input, or -1
+        Gate *gate;     // gate of the input graph, if any
+        unsigned int origin;    // see Gate
+    };
+
+    struct Cut {
+        int n_leaves;
+        int leaves[CUT_SIZE];
+    };
+
+    int import_gate(Gate *gate, std::map<Gate*,int> &imported);
+    int make_node(GateType type, int left, int right);
+    int constant_node(int value);
+    int resolve(int n) const;
+    const std::vector<Cut> &get_cuts(int n);
+    void merge_cuts(int n);
+    unsigned int cut_function(int n, const Cut &cut,
+                              std::map<int,unsigned int> &values) const;
+    void rewrite_node(int n);
+    int build_impl(const Cut &cut, unsigned int function);
+    int build_xor(unsigned int mask, const int *generators);
+    void replace(int n, int r);
+    void ref_rec(int n);
+    int deref_rec(int n, bool remove);
+    void erase_key(int n);
+    Gate *emit(int n, std::vector<Gate*> &emitted);
+
+    Arena &arena;
+    const std::map<Gate*,int> &constant_gates;
+    std::vector<Node> nodes;
+    std::vector<std::vector<Cut> > cuts;
+    std::vector<bool> has_cuts;
+    std::map<std::pair<GateType,std::pair<int,int> >,int> table;
+    GateTable made_gates;
+    int constant_nodes[2];
+    unsigned int current_origin;    // of the nodes make_node adds
+};
+
+}
+
+#endif // REWRITE_H
@@ -3,6 +3,7 @@
 #include <fstream>
 #include <algorithm>
 #include <string>
+#include <set>
 #include <json/json.h>
 
 using namespace scdl;
@@ -106,16 +107,17 @@ void read_variable(const compiler::SCDLProgram *prog,
             is_signed = true;
         case VAR_UINT:
             {   
-                uint64_t n;
-                uint64_t limit = 1 << ((is_signed) ? (n_bits - 1) : n_bits);
+                int64_t n;
+                uint64_t limit =
+                    (uint64_t) 1 << ((is_signed) ? (n_bits - 1) : n_bits);
                 do {
                     std::cout << "(" << ((is_signed) ? "" : "u")
                               << "int<" << n_bits << ">): ";
                     std::cin >> n;
                 }
-                while (abs(n) > limit);
+                while ((uint64_t) std::abs(n) > limit);
 
-                unsigned long v = abs(n);
+                uint64_t v = std::abs(n);
 
                 // if signed, convert to 2's complement representation
                 if (is_signed && n < 0)
@@ -213,16 +215,52 @@ void print_variable(const Variable &var,
     };  
 
 }
+
+std::vector<std::string> output_wires(const Vars &vars)
+{
+    std::vector<std::string> wires;
+    std::set<std::string> seen;
+
+    for (size_t i = 0; i < vars.outputs.size(); i++) {
+        const Variable &var = vars.outputs[i];
+        for (size_t j = 0; j < var.components.size(); j++) {
+            if (seen.insert(var.components[j]).second)
+                wires.push_back(var.components[j]);
+        }
+    }
+
+    return wires;
+}
 }
 
 CompilerResult SCDLEvaluator::compile(std::istream &scdl_in,
-                                      std::istream &vars_in)
+                                      std::istream &vars_in,
+                                      const CompileOptions &options)
 {
-    compiler::SCDLProgram *prog =
-        compiler::SCDLProgram::compile_program_from_stream(scdl_in);
-
     Vars *vars = read_vars_file(vars_in);
 
+    // Only the output wires are evaluated, the other functions are dropped
+    CompileOptions vars_options = options;
+    if (vars_options.outputs.empty())
+        vars_options.outputs = output_wires(*vars);
+    compiler::SCDLProgram *prog;
+    try {
+        prog = compiler::SCDLProgram::compile_program_from_stream(
+            scdl_in, vars_options);
+    }
+    catch (...) {
+        delete vars;
+        throw;
+    }
+
+    const OptimizeStats &stats = prog->get_optimize_stats();
+    std::cerr << "Multiplicative depth: " << stats.depth_before
+              << " before optimization, " << stats.depth_after << " after"
+              << std::endl;
+    std::cerr << "Multiplications: " << stats.n_mult_before
+              << " before optimization, " << stats.n_mult_after << " after"
+              << std::endl;
+
     CompilerResult result;
     result.program = prog;
     result.vars = *vars;
@@ -232,7 +270,61 @@ CompilerResult SCDLEvaluator::compile(std::istream &scdl_in,
     return result;
 }
 
-void SCDLEvaluator::evaluate(CompilerResult &result)
+static const char *engine_names[] = {"recursive", "iterative", "leveled",
+                                     "dataflow"};
+
+EvalEngine SCDLEvaluator::parse_engine(const std::string &name)
+{
+    for (int i = 0; i < 4; i++) {
+        if (name == engine_names[i])
+            return (EvalEngine) i;
+    }
+    throw "Unknown engine";
+}
+
+/* Gate counts indexed by GateType */
+static json_object *gate_counts_to_json(const size_t n_gates[4])
+{
+    json_object *gates = json_object_new_object();
+    json_object_object_add(gates, "mult",
+                           json_object_new_int64(n_gates[GATE_MULT]));
+    json_object_object_add(gates, "add",
+                           json_object_new_int64(n_gates[GATE_ADD]));
+    json_object_object_add(gates, "out",
+                           json_object_new_int64(n_gates[GATE_OUT]));
+    json_object_object_add(gates, "in",
+                           json_object_new_int64(n_gates[GATE_IN]));
+    return gates;
+}
+
+static json_object *eval_stats_to_json(const EvalStats &stats)
+{
+    json_object *obj = json_object_new_object();
+    json_object_object_add(obj, "evaluations",
+                           json_object_new_int64(stats.n_evaluations));
+    json_object_object_add(obj, "seconds",
+                           json_object_new_double(stats.seconds));
+
+    json_object_object_add(obj, "gates", gate_counts_to_json(stats.n_gates));
+
+    json_object_object_add(obj, "copies",
+                           json_object_new_int64(stats.n_copies));
+    json_object_object_add(obj, "constructions",
+                           json_object_new_int64(stats.n_constructions));
+    json_object_object_add(obj, "peak_live_values",
+                           json_object_new_int64(stats.peak_live_values));
+
+    json_object *levels = json_object_new_array();
+    for (size_t i = 0; i < stats.level_seconds.size(); i++)
+        json_object_array_add(levels,
+                              json_object_new_double(stats.level_seconds[i]));
+    json_object_object_add(obj, "level_seconds", levels);
+
+    return obj;
+}
+
+void SCDLEvaluator::evaluate(CompilerResult &result, EvalEngine engine,
+                             std::ostream *stats_out)
 {
     scdl::compiler::SCDLProgram *prog = result.program;
     Vars vars = result.vars;
@@ -254,35 +346,101 @@ void SCDLEvaluator::evaluate(CompilerResult &result)
         read_variable(prog, var, bit_inputs, n_bit_inputs);
     }
 
+    // Every output wire is evaluated in one pass over the gate pool
+    std::vector<std::string> wires = output_wires(vars);
+
     std::map<std::string,int> wire_bits;
-    for (itr = vars.outputs.begin(); itr != vars.outputs.end(); itr++) {
-        Variable var = *itr;
-        for (int i = 0; i < var.components.size(); i++) {
-            std::cout << "Running bit " << i << std::endl;
-            // If we have not evaluated the wire yet, evaluate now
-            if (wire_bits.find(var.components[i]) == wire_bits.end()) {
-                if (!prog->has_circuit(var.components[i])) {
-                    throw ("Could not find definition for "
-                           + var.components[i]).c_str();
-                }
-                Circuit *circ = prog->get_circuit(var.components[i]);
-                std::cout << "depth: " << circ->get_mult_depth() << std::endl;
-                std::cout << "Num add gates: " << circ->get_num_add_gates()
-                          << std::endl;
-                std::cout << "Num mult gates: " << circ->get_num_mult_gates()
-                          << std::endl;
-                
-                
-                int v = prog->run(var.components[i], bit_inputs,
-                                   bit_constants) % 2;
-                
-                if (v < 2)
-                     v = (v + 2) % 2;
+    EvalStats stats;
+    if (!wires.empty()) {
+        std::vector<int> values;
+        prog->run(wires, bit_inputs, bit_constants, values, engine,
+                  (stats_out != NULL) ? &stats : NULL);
+        for (size_t i = 0; i < wires.size(); i++) {
+            int v = values[i] % 2;
+
+            if (v < 2)
+                v = (v + 2) % 2;
+
+            wire_bits[wires[i]] = v;
+        }
+    }
 
-                wire_bits[var.components[i]] = v;
+    for (itr = vars.outputs.begin(); itr != vars.outputs.end(); itr++)
+        print_variable(*itr, wire_bits);
+
+    if (stats_out != NULL) {
+        json_object *obj = json_object_new_object();
+        json_object_object_add(obj, "engine",
+                               json_object_new_string(engine_names[engine]));
+        json_object_object_add(obj, "evaluation", eval_stats_to_json(stats));
+
+        /*
+         * The pass above is not repeated per wire: each wire is given the
+         * gates of its cone in the pool, and the gates among them that no
+         * other output wire needs, which are what leaving it out saves.
+         * Its time is that of the gates of its cone, each gate taking an
+         * equal share of the time of its dependency level in the pass.
+         */
+        const Circuit *pool = prog->get_gate_pool();
+        std::vector<CircuitCone> cones(wires.size());
+        std::vector<unsigned int> n_wires;
+        std::vector<unsigned int> level_of;
+        std::vector<size_t> gates_at_level;
+        if (pool != NULL) {
+            n_wires.assign(pool->get_num_gates(), 0);
+            pool->get_gate_levels(level_of);
+            gates_at_level.assign(pool->get_num_levels(), 0);
+        }
+        for (size_t i = 0; i < wires.size(); i++) {
+            prog->get_cone(wires[i], cones[i]);
+            for (size_t k = 0; k < cones[i].get_num_gates(); k++) {
+                unsigned int g = cones[i].get_gate_index(k);
+                if (n_wires[g]++ == 0)
+                    gates_at_level[level_of[g]]++;
             }
         }
-        print_variable(var, wire_bits);
+
+        json_object *circuits = json_object_new_object();
+        for (size_t i = 0; i < wires.size(); i++) {
+            size_t n_gates[4] = {0, 0, 0, 0};
+            size_t n_own_gates[4] = {0, 0, 0, 0};
+            double seconds = 0;
+            for (size_t k = 0; k < cones[i].get_num_gates(); k++) {
+                unsigned int g = cones[i].get_gate_index(k);
+                n_gates[pool->get_gate_type(g)]++;
+                if (n_wires[g] == 1)
+                    n_own_gates[pool->get_gate_type(g)]++;
+                seconds += stats.level_seconds[level_of[g]] /
+                           gates_at_level[level_of[g]];
+            }
+
+            CircuitStats circ_stats(pool, &cones[i]);
+            json_object *circ_obj = json_object_new_object();
+            json_object_object_add(circ_obj, "seconds",
+                                   json_object_new_double(seconds));
+            json_object_object_add(circ_obj, "gates",
+                                   gate_counts_to_json(n_gates));
+            json_object_object_add(circ_obj, "own_gates",
+                                   gate_counts_to_json(n_own_gates));
+            json_object_object_add(circ_obj, "mult_depth",
+                json_object_new_int(circ_stats.get_mult_depth()));
+            json_object_object_add(circ_obj, "levels",
+                json_object_new_int64(circ_stats.get_num_levels()));
+
+            const std::vector<size_t> &mults =
+                circ_stats.get_mult_histogram();
+            json_object *histogram = json_object_new_array();
+            for (size_t d = 1; d < mults.size(); d++)
+                json_object_array_add(histogram,
+                                      json_object_new_int64(mults[d]));
+            json_object_object_add(circ_obj, "mults_per_depth", histogram);
+            json_object_object_add(circuits, wires[i].c_str(), circ_obj);
+        }
+        json_object_object_add(obj, "circuits", circuits);
+
+        *stats_out << json_object_to_json_string_ext(obj,
+            JSON_C_TO_STRING_PRETTY) << std::endl;
+        json_object_put(obj);
     }
     
     delete[] bit_inputs;
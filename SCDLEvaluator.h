@@ -26,17 +26,37 @@ void read_variable(const compiler::SCDLProgram *prog,
 void print_variable(const Variable &var,
                     std::map<std::string,int> &wire_bits);
 
+/* The components of the outputs, each once, in the order they appear */
+std::vector<std::string> output_wires(const Vars &vars);
+
 
 
 class SCDLEvaluator {
  public:
     SCDLEvaluator();
 
-    static CompilerResult compile(std::istream &scdl_in, std::istream &vars_in);
+    /* The outputs of options, if empty, are the output wires of the vars */
+    static CompilerResult compile(std::istream &scdl_in, std::istream &vars_in,
+                                  const CompileOptions &options=CompileOptions());
     //       throws const char *;
 
-    static void evaluate(CompilerResult &result);
+    /*
+     * The output wires are evaluated in a single pass over the gate pool.
+     * If stats_out is not NULL, statistics of that pass are written to it
+     * as JSON, followed by what each output wire accounts for in it: the
+     * gates of its cone, those no other output wire needs, its
+     * multiplicative depth and the time of its gates, apportioned from the
+     * time per level of the pass. No output wire is evaluated again on its
+     * own.
+     */
+    static void evaluate(CompilerResult &result,
+                         EvalEngine engine=ENGINE_RECURSIVE,
+                         std::ostream *stats_out=NULL);
         //throws const *char;
+
+    /* "recursive", "iterative", "leveled" or "dataflow" */
+    static EvalEngine parse_engine(const std::string &name);
+    //       throws const char *;
 };
 }
 
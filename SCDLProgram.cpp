@@ -1,16 +1,19 @@
 #include "Circuit.h"
-#include "common.h"
 #include <stack>
+#include <list>
 #include <fstream>
-#include <boost/algorithm/string.hpp>
-#include <boost/lexical_cast.hpp>
+#include <iterator>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
 
 #include "SCDLProgram.h"
-
-#define BUFFER_SIZE 1024
+#include "GateTable.h"
+#include "Arena.h"
+#include "Lexer.h"
+#include "MappedFile.h"
 
 using namespace std;
-using namespace boost;
 
 namespace scdl {
 
@@ -46,6 +49,7 @@ enum TokenType {
 struct FunctionDesc;
 
 
+/* Trivially copyable, so that the RPN of a function can live in the Arena */
 struct Token {
     TokenType type;
 
@@ -55,43 +59,59 @@ struct Token {
 
     Token(TokenType type, Gate *gate) : type(type), gate(gate) {}
 
-    Token(TokenType type, FunctionDesc *f, vector<Gate*> args)
-       : type(TOKEN_FUNCTION), function(f), args(args) {}
-
-    Token(string arg_name) : type(TOKEN_ARGUMENT), arg_name(arg_name) {}
-
-    Token(TokenType type, string arg_name) : type(type), arg_name(arg_name) {}
+    /* Call of f, its arguments are the preceding expressions */
+    Token(FunctionDesc *f) : type(TOKEN_FUNCTION), function(f) {}
 
-    Gate *gate;
-    FunctionDesc *function;
-    vector<Gate*> args;
-    string arg_name;
+    Token(TokenType type, size_t arg_index)
+       : type(type), arg_index(arg_index) {}
 
+    union {
+        Gate *gate;
+        FunctionDesc *function;
+        size_t arg_index;
+    };
 };
 
-struct FunctionDesc {
-    string name;
-    vector<string> params;
-    list<Token> tokens;
+/* Arguments of a call as they lie on the evaluation stack */
+struct GateSpan {
+    Gate *const *gates;
+    size_t n_gates;
 };
 
+/* Lets the instances of a function be looked up without copying the key */
+struct ArgsLess {
+    typedef void is_transparent;
 
-struct Operation {
-    Gate *left;
-    Gate *right;
-    GateType op;
+    bool operator()(const vector<Gate*> &a, const vector<Gate*> &b) const {
+        return a < b;
+    }
 
-    bool operator<(const Operation &oper) const {
-        if (left < oper.left)
-            return true;
-        if (left == oper.left && right < oper.right)
-            return true;
-        if (left == oper.left && right == oper.right && op < oper.op)
-            return true;
-        return false;
+    bool operator()(const vector<Gate*> &a, const GateSpan &b) const {
+        return lexicographical_compare(a.begin(), a.end(),
+                                       b.gates, b.gates + b.n_gates);
+    }
+
+    bool operator()(const GateSpan &a, const vector<Gate*> &b) const {
+        return lexicographical_compare(a.gates, a.gates + a.n_gates,
+                                       b.begin(), b.end());
     }
 };
 
+typedef map<vector<Gate*>,Gate*,ArgsLess> InstanceMap;
+
+/*
+ * A function is kept as the RPN of its body. Calls are instantiated on the
+ * gates of their arguments, and calls with the same argument gates share
+ * one instance.
+ */
+struct FunctionDesc {
+    string name;
+    unsigned int index;     // in Provenance::function_names
+    vector<string> params;
+    Token *tokens;      // allocated from the Arena
+    size_t n_tokens;
+    InstanceMap instances;
+};
 
 
 typedef map<string,FunctionDesc*> FunctionDescMap;
@@ -99,14 +119,8 @@ typedef pair<string,FunctionDesc*> FuncMapping;
 
 /* Building-block functions for parsing programs */
 
-void instantiate_function(list<Token> &output,
-                          FunctionDesc *f,
-                          map<string,FunctionDesc*> bindings);
-int parse_array_index(string expr, int pos, unsigned int *index);
-int parse_function_call(string expr, int pos, vector<string> &arg_exprs);
-string print_tokens(const list<Token> &tokens);
-string array_name(const string &aname, unsigned int index);
-bool is_special_char(char c);
+string print_tokens(const Token *tokens, size_t n_tokens);
+string array_name(string_view aname, unsigned int index);
 bool is_operator(Token token);
 void print_stack(std::stack<Token> stack);
 void print_circuit(Gate *gate);
@@ -134,9 +148,18 @@ struct SymbolInfo {
     FunctionDesc *func;
 };
 
-typedef map<string,SymbolInfo> SymbolTable;
+// std::less<> so that symbols can be looked up by a string_view
+typedef map<string,SymbolInfo,less<> > SymbolTable;
 typedef pair<string,SymbolInfo> SymbolMapping;
 
+/* A parameter, or all the elements of a vector parameter */
+struct ParamInfo {
+    size_t index;
+    size_t len;
+};
+
+typedef map<string,ParamInfo,less<> > ParamMap;
+
 
 class Compilation {
 public:
@@ -146,14 +169,36 @@ public:
     bool run();
     bool is_finished();
 
+    /* Time spent in build_circuit_from_rpn by the functions without
+       parameters, which includes the instantiation of every call */
+    double get_build_seconds() const {
+        return build_seconds;
+    }
+
     void fill_variable_info(map<string,Variable> &name_to_index);
     void fill_constant_info(map<string,Constant> &name_to_constant);
+    void fill_constant_gates(map<Gate*,int> &gate_to_value);
     void fill_function_info(map<string,Function> &name_to_function);
+    void release_gates(Arena &gate_arena);
+    void release_provenance(Provenance &prov);
 
 private:
     bool compile(std::istream &is);
-    FunctionDesc *parse_function(string expr, const vector<string> &params);
-    FunctionDesc *read_function(string str);
+    bool parse_statement(Lexer &lexer);
+    void parse_input(Lexer &lexer);
+    void parse_constant(Lexer &lexer);
+    void parse_include(Lexer &lexer);
+    void parse_func(Lexer &lexer);
+    void parse_expression(Lexer &lexer, const ParamMap &params,
+                          vector<Token> &output);
+    void parse_product(Lexer &lexer, const ParamMap &params,
+                       vector<Token> &output);
+    void parse_factor(Lexer &lexer, const ParamMap &params,
+                      vector<Token> &output);
+    void parse_call(Lexer &lexer, FunctionDesc *f, const ParamMap &params,
+                    vector<Token> &output);
+    size_t parse_argument(Lexer &lexer, const ParamMap &params,
+                          vector<Token> &output);
     void add_new_function(FunctionDesc *desc, Gate *gate=NULL);
     void add_new_variable(string name, size_t len=1);
     void add_new_function(string name, FunctionDesc *desc);
@@ -161,17 +206,26 @@ private:
     void add_new_variable(string name, size_t len, unsigned int index);
     Gate *alloc_input_gate(unsigned int input_index);
     Gate *alloc_operator_gate(GateType type, Gate *left, Gate *right);
-    Gate *build_circuit_from_rpn_rec(list<Token> &tokens);
-    Gate *build_circuit_from_rpn(const list<Token> &tokens);
+    unsigned int new_call_site(FunctionDesc *f, unsigned int parent);
+    Gate *make_operation(GateType type, Gate *left, Gate *right);
+    Gate *instantiate_function(FunctionDesc *f, Gate *const *args,
+                               size_t n_args);
+    Gate *build_circuit_from_rpn(const Token *tokens, size_t n_tokens,
+                                 Gate *const *args, size_t n_args);
 
     bool finished;
-    map<Operation,Gate*> operations;
-    vector<Gate*> allocated_gates;
+    GateTable operations;
+    Arena arena;
+    vector<Gate*> rpn_stack;    // shared by nested instantiations
+    vector<Token> rpn_tokens;
     std::istream &is;
     SymbolTable sym_table;
     size_t num_inputs;
     size_t num_constants;
     size_t num_functions;
+    double build_seconds;
+    Provenance provenance;
+    unsigned int current_site;  // origin of the gates being built
 };
 
 /* 
@@ -180,10 +234,15 @@ private:
  * #########################################################
  */
 
-SCDLProgram::SCDLProgram(map<string,Gate*> &func_gates,
+SCDLProgram::SCDLProgram(const map<string,Gate*> &func_gates,
                          map<string,Variable> &var_map,
-                         map<string,Constant> &const_map) 
-    : var_map(var_map), var_names(var_map.size()), const_map(const_map) {
+                         map<string,Constant> &const_map,
+                         const OptimizeStats &optimize_stats,
+                         Provenance &provenance)
+    : var_map(var_map), var_names(var_map.size()), const_map(const_map),
+      optimize_stats(optimize_stats), image(NULL), gate_pool(NULL) {
+
+    std::swap(this->provenance, provenance);
 
     map<string,Variable>::iterator itr;
     int i = 0;
@@ -200,19 +259,29 @@ SCDLProgram::SCDLProgram(map<string,Gate*> &func_gates,
         const_names.push_back(citr->first);
         n_inputs++;
     }
-    map<string,Gate*>::iterator fitr;
+
+    // One circuit over all the functions holds every distinct gate once,
+    // so the gate graph is not needed once it is built
+    map<string,Gate*>::const_iterator fitr;
+    vector<Gate*> output_gates;
     for (fitr = func_gates.begin(); fitr != func_gates.end(); fitr++) {
-        circuit_map[fitr->first] = new Circuit(n_inputs, fitr->second);
+        output_of[fitr->first] = circuit_names.size();
         circuit_names.push_back(fitr->first);
+        output_gates.push_back(fitr->second);
     }
+    if (!output_gates.empty())
+        gate_pool = new Circuit(n_inputs, output_gates);
+}
+
+SCDLProgram::SCDLProgram()
+    : n_var_inputs(0), image(NULL), gate_pool(NULL)
+{
 }
 
 SCDLProgram::~SCDLProgram() {
-    map<string,Circuit*>::iterator itr;
-    for (itr = circuit_map.begin(); itr != circuit_map.end(); itr++) {
-        delete itr->second;
-    }
-    circuit_map.clear();
+    // The circuits of a loaded program refer to the mapping
+    delete gate_pool;
+    delete image;
 }
 
 bool SCDLProgram::has_variable(const string &var_name) const
@@ -272,9 +341,36 @@ size_t SCDLProgram::get_num_variable_inputs() const
     return n_var_inputs;
 }
 
-Circuit *SCDLProgram::get_circuit(const std::string &circuit_name) const
+void SCDLProgram::get_cone(const string &circuit_name, CircuitCone &cone) const
 {
-    return circuit_map.at(circuit_name);
+    get_cone(vector<string>(1, circuit_name), cone);
+}
+
+void SCDLProgram::get_cone(const vector<string> &circuit_names,
+                           CircuitCone &cone) const
+{
+    vector<unsigned int> output_nos;
+    for (size_t i = 0; i < circuit_names.size(); i++) {
+        map<string,unsigned int>::const_iterator oitr =
+            output_of.find(circuit_names[i]);
+        if (oitr == output_of.end()) {
+            // Only the functions of CompileOptions::outputs are kept, so an
+            // image eval wrote has only those of its output wires
+            cerr << "Function " << circuit_names[i] << " is not in the "
+                 << ((image != NULL) ? "program image" : "program") << endl;
+            throw "Could not find circuit";
+        }
+        output_nos.push_back(oitr->second);
+    }
+
+    cone = CircuitCone(gate_pool, output_nos);
+}
+
+CircuitStats SCDLProgram::get_circuit_stats(const string &circuit_name) const
+{
+    CircuitCone cone;
+    get_cone(circuit_name, cone);
+    return CircuitStats(gate_pool, &cone);
 }
 
 vector<string>::const_iterator SCDLProgram::get_circuit_names() const
@@ -285,16 +381,21 @@ vector<string>::const_iterator SCDLProgram::get_circuit_names() const
 
 bool SCDLProgram::has_circuit(const std::string &circuit_name) const
 {
-    return circuit_map.find(circuit_name) != circuit_map.end();
+    return output_of.find(circuit_name) != output_of.end();
 }
 
 size_t SCDLProgram::get_num_circuits() const
 {
-    return circuit_map.size();
+    return circuit_names.size();
 }
 
-SCDLProgram *SCDLProgram::compile_program_from_stream(std::istream &is)
+SCDLProgram *SCDLProgram::compile_program_from_stream(std::istream &is,
+                                        const CompileOptions &options)
 {
+    typedef chrono::steady_clock clock;
+    CompileTimings timings;
+    clock::time_point start = clock::now();
+
     Compilation compilation(is);
     compilation.run();
 
@@ -309,6 +410,22 @@ SCDLProgram *SCDLProgram::compile_program_from_stream(std::istream &is)
         if (f.params.size() == 0)
             gate_map[itr->first] = f.output_gate;
     }
+
+    // The gates that no output reaches go with the arena below
+    if (!options.outputs.empty()) {
+        map<string,Gate*> output_map;
+        for (size_t i = 0; i < options.outputs.size(); i++) {
+            map<string,Gate*>::iterator gitr =
+                gate_map.find(options.outputs[i]);
+            if (gitr == gate_map.end()) {
+                cerr << "Output wire " << options.outputs[i]
+                     << " is not a function without parameters" << endl;
+                throw "Could not find definition for output wire";
+            }
+            output_map.insert(*gitr);
+        }
+        gate_map.swap(output_map);
+    }
         
     // if (name_to_function.find("out") == name_to_function.end())
     //     throw "No output circuit defined";
@@ -319,7 +436,36 @@ SCDLProgram *SCDLProgram::compile_program_from_stream(std::istream &is)
     compilation.fill_variable_info(name_to_variable);
     compilation.fill_constant_info(name_to_constant);
 
-    return new SCDLProgram(gate_map, name_to_variable, name_to_constant);;
+    // Freed on return, the gate pool of the program holds the gates
+    Arena arena;
+    compilation.release_gates(arena);
+    Provenance provenance;
+    compilation.release_provenance(provenance);
+
+    chrono::duration<double> d = clock::now() - start;
+    timings.build_seconds = compilation.get_build_seconds();
+    timings.parse_seconds = d.count() - timings.build_seconds;
+
+    start = clock::now();
+    OptimizeStats stats;
+    if (options.optimize) {
+        map<Gate*,int> constant_gates;
+        compilation.fill_constant_gates(constant_gates);
+        Optimizer optimizer(options, arena, constant_gates);
+        optimizer.run(gate_map);
+        stats = optimizer.get_stats();
+    }
+    d = clock::now() - start;
+    timings.optimize_seconds = d.count();
+
+    start = clock::now();
+    SCDLProgram *prog = new SCDLProgram(gate_map, name_to_variable,
+                                        name_to_constant, stats, provenance);
+    d = clock::now() - start;
+    timings.circuit_seconds = d.count();
+    prog->compile_timings = timings;
+
+    return prog;
 }
 
 SCDLProgram *SCDLProgram::compile_program_from_file(string file_name)
@@ -367,6 +513,16 @@ void Compilation::fill_constant_info(map<string,Constant> &name_to_constant)
     }
 }
 
+void Compilation::fill_constant_gates(map<Gate*,int> &gate_to_value)
+{
+    for (SymbolTable::iterator itr = sym_table.begin(); itr != sym_table.end();
+         itr++) {
+        SymbolInfo sym = itr->second;
+        if (sym.type == SYM_CONSTANT)
+            gate_to_value[sym.gates[0]] = sym.constant_value;
+    }
+}
+
 void Compilation::fill_function_info(map<string,Function> &name_to_function)
 {
     // fill function info
@@ -387,309 +543,116 @@ void Compilation::fill_function_info(map<string,Function> &name_to_function)
 
 
 
-Gate *Compilation::build_circuit_from_rpn_rec(list<Token> &tokens)
+void Compilation::release_gates(Arena &gate_arena)
 {
-    if (tokens.empty())
-        return NULL;
+    gate_arena.swap(arena);
+}
 
-    Token token = tokens.back();
-    tokens.pop_back();
+void Compilation::release_provenance(Provenance &prov)
+{
+    std::swap(prov, provenance);
+}
 
-    if (token.type == TOKEN_OPERAND)
-        return token.gate;
-    else if (token.type == TOKEN_CIRCUIT)
-        return token.gate;                                             
-    else if (is_operator(token.type)) {
-        Gate *right = build_circuit_from_rpn_rec(tokens);
-        if (right == NULL)
-            return NULL;
-
-        Gate *left = build_circuit_from_rpn_rec(tokens);
-        if (left == NULL)
-            return NULL;
-
-        Operation oper;
-        oper.left = left;
-        oper.right = right;
-        oper.op = (token.type == TOKEN_OP_MUL) ? GATE_MULT : GATE_ADD;
-
-        if (operations.find(oper) == operations.end()) {        
-            Gate *op_gate = alloc_operator_gate((token.type == TOKEN_OP_MUL)
-                                                ? GATE_MULT : GATE_ADD,
-                                                left, right);
-            operations.insert(pair<Operation,Gate*>(oper, op_gate));
-            return op_gate;
+/*
+ * Evaluates the RPN of an expression with args bound to the parameters.
+ * Returns NULL if the RPN is malformed.
+ */
+Gate *Compilation::build_circuit_from_rpn(const Token *tokens, size_t n_tokens,
+                                          Gate *const *args, size_t n_args)
+{
+    size_t base = rpn_stack.size();
+
+    for (size_t i = 0; i < n_tokens; i++) {
+        const Token &token = tokens[i];
+        size_t depth = rpn_stack.size() - base;
+
+        if (token.type == TOKEN_OPERAND || token.type == TOKEN_CIRCUIT)
+            rpn_stack.push_back(token.gate);
+        else if (token.type == TOKEN_ARGUMENT) {
+            if (token.arg_index >= n_args)
+                throw "Argument not bound";
+            rpn_stack.push_back(args[token.arg_index]);
+        }
+        else if (token.type == TOKEN_FUNCTION) {
+            size_t n_call_args = token.function->params.size();
+            if (depth < n_call_args)
+                break;
+            Gate *gate = instantiate_function(token.function,
+                rpn_stack.data() + rpn_stack.size() - n_call_args, n_call_args);
+            rpn_stack.resize(rpn_stack.size() - n_call_args);
+            rpn_stack.push_back(gate);
+        }
+        else if (is_operator(token.type)) {
+            if (depth < 2)
+                break;
+            Gate *right = rpn_stack.back();
+            rpn_stack.pop_back();
+            Gate *left = rpn_stack.back();
+            rpn_stack.pop_back();
+            rpn_stack.push_back(make_operation((token.type == TOKEN_OP_MUL)
+                                               ? GATE_MULT : GATE_ADD,
+                                               left, right));
         }
-        
-        return operations[oper];
     }
 
-    return NULL;
+    Gate *gate = NULL;
+    if (rpn_stack.size() == base + 1)
+        gate = rpn_stack.back();
+    rpn_stack.resize(base);
+
+    return gate;
 }
 
-Gate *Compilation::build_circuit_from_rpn(const list<Token> &tokens)
+/*
+ * Builds the body of f over the argument gates. Each instance costs the
+ * size of the body of f, not of the functions it calls, since those are
+ * instances themselves.
+ */
+Gate *Compilation::instantiate_function(FunctionDesc *f, Gate *const *args,
+                                        size_t n_args)
 {
-    list<Token> tokens_copy = tokens;
-
-    return build_circuit_from_rpn_rec(tokens_copy);
+    GateSpan key = {args, n_args};
+    InstanceMap::iterator itr = f->instances.find(key);
+    if (itr != f->instances.end())
+        return itr->second;
+
+    // args may point into rpn_stack, which the body is evaluated on, so the
+    // body is evaluated over the copy in the key
+    itr = f->instances.insert(make_pair(vector<Gate*>(args, args + n_args),
+                                        (Gate*) NULL)).first;
+    const vector<Gate*> &bound = itr->first;
+    unsigned int caller = current_site;
+    current_site = new_call_site(f, caller);
+    Gate *gate = build_circuit_from_rpn(f->tokens, f->n_tokens, bound.data(),
+                                        bound.size());
+    current_site = caller;
+    if (gate == NULL)
+        throw "Invalid function body";
+    itr->second = gate;
+
+    return gate;
 }
 
 
 Compilation::Compilation(std::istream &is)
     : is(is), finished(false), num_inputs(0), num_constants(0),
-      num_functions(0)
+      num_functions(0), build_seconds(0), current_site(NO_ORIGIN)
 {
 }
 
 Compilation::~Compilation()
 {
-    vector<Gate*>::iterator itr;
-    for (itr = allocated_gates.begin(); itr != allocated_gates.end(); itr++)
-        delete *itr;
+    // The gates and token arrays go with the Arena
     for (SymbolTable::iterator sitr = sym_table.begin();
          sitr != sym_table.end(); sitr++) {
-        if (sitr->second.gates != NULL) {
-            delete[] sitr->second.gates;
-            sitr->second.gates = NULL;
-        }
         if (sitr->second.type == SYM_FUNCTION)
             delete sitr->second.func;
     }
 }
 
-/*
- * TODO: This method badly needs tidyng up and refactoring.
- * Also control flow changes (avoidance of continue) are needed.
- */
-FunctionDesc *Compilation::parse_function(string expr,
-                                          const vector<string> &params)
-{
-    expr += ";";
-
-    string cur_sym_name;
-
-    stack<Token> stack;
-    list<Token> output;
-    int pos = 0;
-
-    /* Here we run the shunting yard algorithm to make an RPN queue (output) */
-    while (pos < expr.length()) {
-        if (expr[pos] == ' ' || expr[pos] == '\n') {
-            pos++;
-            continue;
-        }
-        char t = expr[pos];
-
-        if (is_special_char(t) && cur_sym_name != "") {
-            unsigned int ind;
-            if (t == '[') {
-                int newpos = parse_array_index(expr, pos, &ind);
-                string name = array_name(cur_sym_name, ind);
-                if (find(params.begin(), params.end(), name) != params.end()) {
-                    output.push_back(Token(TOKEN_ARGUMENT, name));
-                    pos = newpos;
-                    cur_sym_name = "";
-                    continue;
-                }
-            }
-            
-            if (find(params.begin(), params.end(), cur_sym_name) !=
-                     params.end()) {
-                // Handle argument
-                output.push_back(Token(TOKEN_ARGUMENT, cur_sym_name));       
-            }
-            else if (sym_table.find(cur_sym_name) != sym_table.end()) {
-                // Symbol exists
-                SymbolInfo sym = sym_table[cur_sym_name];
-                switch (sym.type) {
-                    case SYM_VARIABLE:
-                        if (sym.len > 1) {
-                            if (t != '[')
-                                throw "Expected [";
-
-                            // we decrement returned pos because it is
-                            // incremented below
-                            pos = parse_array_index(expr, pos, &ind) - 1;
-                            if (ind >= sym.len)
-                                throw "Index out of range";
-                            output.push_back(Token(TOKEN_OPERAND,
-                                                   sym.gates[ind]));
-                        }
-                        else {
-                            output.push_back(Token(TOKEN_OPERAND,
-                                                   sym.gates[0]));
-                        }
-                        break;
-                    case SYM_CONSTANT:
-                        output.push_back(Token(TOKEN_OPERAND, sym.gates[0]));
-                        break;
-                    case SYM_FUNCTION:
-                        FunctionDesc *f = sym.func;
-                        if (f->params.size() != 0) {
-                            if (t != '(')
-                                throw "FunctionDesc expects arguments";
-                            vector<string> pre_arg_exprs;
-                            vector<string> arg_exprs; 
-                            pos = parse_function_call(expr, ++pos,
-                                                      pre_arg_exprs);
-                            for (int i = 0; i < pre_arg_exprs.size(); i++) {
-                                string arg = pre_arg_exprs[i];
-                                trim(arg);
-                                if (sym_table.find(arg) != sym_table.end()) {
-                                    SymbolInfo sym = sym_table[arg];
-                                    if (sym.type == SYM_VARIABLE &&
-                                            sym.len > 1) {
-                                        for (int j = 0; j < sym.len; j++) {
-                                            string name = array_name(arg, j);
-                                            arg_exprs.push_back(name);
-                                        }
-                                    }
-                                    else
-                                        arg_exprs.push_back(arg);
-                                }
-                                else
-                                    arg_exprs.push_back(arg);
-                            }
-                            // Parse args strings
-                            if (arg_exprs.size() != f->params.size()) {
-                                throw "Incorrect number of arguments passed "
-                                      "to function";
-                            }
-                            map<string,FunctionDesc*> args;
-                            for (int i = 0; i < arg_exprs.size(); i++) {
-                                FunctionDesc *g = parse_function(arg_exprs[i],
-                                                                 params);
-                                args[f->params[i]] = g;
-                            }
-                            instantiate_function(output, f, args);
-
-                            pos++; // point to next char for next iteration
-                            cur_sym_name = "";
-                            continue;
-                        }
-                           
-                        else {
-                            output.push_back(Token(TOKEN_CIRCUIT,
-                                                   sym.gates[0]));
-                        }
-                        break;
-                }
-            }
-            else {
-                // Assume it is a new variable
-                add_new_variable(cur_sym_name);
-                Gate *g = sym_table[cur_sym_name].gates[0];
-                output.push_back(Token(g));
-            }
-
-            cur_sym_name = "";
-        }
-
-        if (t == '(') {
-            stack.push(Token(TOKEN_LEFT_PAREN));
-        }
-        else if (t == ')') {
-            while (!stack.empty() && stack.top().type != TOKEN_LEFT_PAREN) {
-                Token token = stack.top();
-                
-                output.push_back(token);
-                stack.pop();
-            }
-            if (stack.empty())
-                throw "Mismatched parenthesis";
-            else
-                stack.pop(); // pop left parenthesis
-        }
-        else if (t == '*' || t == '+') {
-            Token op = Token((t == '*') ? TOKEN_OP_MUL : TOKEN_OP_ADD);
-
-            // * has higher precedence than +
-            while (!stack.empty() && is_operator(stack.top())) {
-                if (op.type == TOKEN_OP_ADD &&
-                        stack.top().type == TOKEN_OP_MUL) {
-                    output.push_back(stack.top());
-                    stack.pop();
-                }
-                else
-                    break;
-            }
-            stack.push(op);
-        }
-        else if (t != '[') {
-            cur_sym_name += t;
-        }
-
-        pos++;
-    }
-    while (!stack.empty()) {
-        Token token = stack.top();
-        stack.pop();
-
-        if (token.type == TOKEN_LEFT_PAREN)
-            throw "Mismatched parenthesis";
-
-        output.push_back(token);
-    }
-    FunctionDesc *f = new FunctionDesc;
-    f->tokens = output;
-    f->params = params;
-
-    return f;
-}
-
-FunctionDesc *Compilation::read_function(string str)
-{
-    vector<string> parts;            
-
-    split(parts, str, is_any_of("="));
-    if (parts.size() < 2)
-        throw "Invalid syntax for function definition";
-
-    vector<string> params;
-    trim(parts[0]);
-    int pos = parts[0].find_first_of("(");
-    if (pos == string::npos) {
-        pos = parts[0].find_first_of("=");
-    }
-    else {
-        if (parts[0][parts[0].length() - 1] != ')')
-            throw "Invalid syntax for function definition";
-        string params_list =
-            parts[0].substr(pos + 1,
-                            (parts[0].length() - 1) - pos - 1);
-        vector<string> pre_params;
-        split(pre_params, params_list, is_any_of(","));
-        for (int i = 0; i < pre_params.size(); i++) {
-            trim(pre_params[i]);
-            vector<string> comps;
-
-            // Check whether param is a vector
-            // split into components (comps) separated by ":"
-            split(comps, pre_params[i], is_any_of(":"));
-            if (comps.size() > 1) {
-                unsigned int vector_len = read_numeric<unsigned int>(comps[1]);
-                for (int j = 0; j < vector_len; j++) {
-                    params.push_back(array_name(comps[0], j));
-                }
-            }
-            else
-                params.push_back(comps[0]);
-        }
-    }
-    string name = parts[0].substr(0, pos);
-
-    trim(parts[1]);
-    FunctionDesc *f = parse_function(parts[1], params);
-    f->name = name;
-    
-    return f;
-}
-
 Gate *Compilation::alloc_input_gate(unsigned int input_index)
 {
-    Gate *g = new_input_gate(input_index);
-    allocated_gates.push_back(g);
-    return g;
+    return arena.new_input_gate(input_index);
 }
 
 void Compilation::add_new_function(FunctionDesc *desc, Gate *gate)
@@ -697,7 +660,7 @@ void Compilation::add_new_function(FunctionDesc *desc, Gate *gate)
     SymbolInfo sym;
     
     sym.name = desc->name;
-    sym.gates = new Gate*[1];
+    sym.gates = arena.allocate_array<Gate*>(1);
     sym.gates[0] = gate;
     sym.type = SYM_FUNCTION;
     sym.func = desc;
@@ -713,7 +676,7 @@ void Compilation::add_new_variable(string var_name, size_t len,
     SymbolInfo sym;
     
     sym.name = var_name;
-    sym.gates = new Gate*[len];
+    sym.gates = arena.allocate_array<Gate*>(len);
     for (int i = 0; i < len; i++)
         sym.gates[i] = alloc_input_gate(index + i);
     sym.len = len;
@@ -737,7 +700,7 @@ void Compilation::add_new_constant(string name, unsigned int value, size_t len)
     sym.len = len;
     sym.type = SYM_CONSTANT;
     sym.constant_value = value;
-    sym.gates = new Gate*[1];
+    sym.gates = arena.allocate_array<Gate*>(1);
     sym.gates[0] = alloc_input_gate(num_constants);
     num_constants++;
 
@@ -748,138 +711,403 @@ void Compilation::add_new_constant(string name, unsigned int value, size_t len)
 
 Gate *Compilation::alloc_operator_gate(GateType type, Gate *left, Gate *right)
 {
-    Gate *g = new_operator_gate(type, left, right);
-    allocated_gates.push_back(g);
+    Gate *g = arena.new_operator_gate(type, left, right);
+    g->origin = current_site;
     return g;
 }
 
+unsigned int Compilation::new_call_site(FunctionDesc *f, unsigned int parent)
+{
+    CallSite site = {f->index, parent};
+    provenance.call_sites.push_back(site);
+    return provenance.call_sites.size() - 1;
+}
+
+/*
+ * Appends the leaves of the chain of type gates rooted at gate. Returns
+ * false if there are more than fit in a GateTable key.
+ */
+static bool collect_chain_leaves(GateType type, Gate *gate, Gate **leaves,
+                                 size_t *n_leaves)
+{
+    if (gate->type != type) {
+        if (*n_leaves == MAX_KEY_OPERANDS)
+            return false;
+        leaves[(*n_leaves)++] = gate;
+        return true;
+    }
+
+    for (size_t i = 0; i < gate->fan_in; i++) {
+        if (!collect_chain_leaves(type, gate->in_gates[i], leaves, n_leaves))
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Hash-consed operator gate. Besides its two operands, the gate is looked
+ * up by the leaves of the chain of the same operator that it completes, so
+ * that chains that only differ in association or order share one gate.
+ * The table spans every function of the program.
+ */
+Gate *Compilation::make_operation(GateType type, Gate *left, Gate *right)
+{
+    Gate *operands[2] = {left, right};
+    Gate *gate = operations.find(type, operands, 2);
+    if (gate != NULL)
+        return gate;
+
+    Gate *leaves[MAX_KEY_OPERANDS];
+    size_t n_leaves = 0;
+    bool chain = collect_chain_leaves(type, left, leaves, &n_leaves) &&
+                 collect_chain_leaves(type, right, leaves, &n_leaves) &&
+                 n_leaves > 2;
+    if (chain)
+        gate = operations.find(type, leaves, n_leaves);
+
+    if (gate == NULL) {
+        gate = alloc_operator_gate(type, left, right);
+        if (chain)
+            operations.insert(type, leaves, n_leaves, gate);
+    }
+    operations.insert(type, operands, 2, gate);
+
+    return gate;
+}
+
 bool Compilation::run()
 {
     if (finished)
         return false;
 
     finished = compile(is);
+
+    // Constants take the inputs after all the variables
+    SymbolTable::iterator itr;
+    for (itr = sym_table.begin(); itr != sym_table.end(); itr++) {
+        SymbolInfo &sym = itr->second;
+        if (sym.type == SYM_CONSTANT)
+            sym.gates[0]->input_index += num_inputs;
+    }
+
     return finished;
 }
 
+static unsigned int parse_number(const Lexeme &lexeme)
+{
+    unsigned int value = 0;
+    const char *end = lexeme.text.data() + lexeme.text.size();
+    from_chars_result result = from_chars(lexeme.text.data(), end, value);
+    if (result.ec != errc() || result.ptr != end)
+        throw "Could not parse numeric value";
+
+    return value;
+}
+
+/* [ NUMBER ] */
+static unsigned int parse_index(Lexer &lexer)
+{
+    lexer.expect(LEX_LEFT_BRACKET, "Expected [");
+    unsigned int index = parse_number(lexer.expect(LEX_NUMBER,
+                                                   "Expected index"));
+    lexer.expect(LEX_RIGHT_BRACKET, "Could not find ]");
+
+    return index;
+}
+
+/* [ : NUMBER ], the length of a vector declaration */
+static size_t parse_length(Lexer &lexer)
+{
+    if (!lexer.accept(LEX_COLON))
+        return 1;
+
+    return parse_number(lexer.expect(LEX_NUMBER, "Expected vector length"));
+}
+
 bool Compilation::compile(std::istream &is)
 {
-    char buf[BUFFER_SIZE];
-    int count;
-
-    while (!is.eof()) {
-        bool more = true;
-        string stmnt;
-        while (!is.eof() && more) {
-            string line;
-            getline(is, line);
-            trim(line);
-            more = (line[line.length() - 1] == '\\');
-            if (more)
-                line.erase(line.end() - 1);
-            stmnt += line;
-        }
+    // The whole source is lexed from one buffer that the lexemes point into
+    string source((istreambuf_iterator<char>(is)),
+                  istreambuf_iterator<char>());
+    Lexer lexer(source);
 
-        if (stmnt.empty())
-            continue;
-
-        /* Ignore comment - marked by # */
-        int first_c_pos = stmnt.find_first_not_of(" \t");
-        if (first_c_pos != string::npos && stmnt[first_c_pos] == '#')
-            continue;
-
-        /*
-         * TODO: Common code for "input" and "constant" should be factored out
-         */
-        vector<string> parts;
-        split(parts, stmnt, is_any_of(" \t"));
-        if (parts[0] == "input") {
-            // input declaration
-            if (parts.size() < 2) 
-                throw "Illegal input declaration";
-            string rhs;
-            for (int i = 1; i < parts.size(); i++)
-                rhs += parts[i];
-
-            unsigned int index = num_inputs; // default value
-            size_t len = 1;
-            
-            vector<string> decl_parts;
-            split(decl_parts, rhs, is_any_of(":"));
-            string var_name = decl_parts[0];
-            trim(var_name);
-
-            if (sym_table.find(var_name) != sym_table.end())
-                throw "Symbol " + var_name  +  " already declared";
-
-            if (decl_parts.size() > 1) {
-                string len_str = decl_parts[1];
-                trim(len_str);
-
-                len = read_numeric<unsigned int>(len_str);
-            }
-            add_new_variable(var_name, len, index);
-        }
-        else if (parts[0] == "constant") {
-                        // input declaration
-            if (parts.size() < 2) 
-                throw "Illegal input declaration";
-            vector<string> decl_parts;            
-            string rhs;
-            for (int i = 1; i < parts.size(); i++)
-                rhs += parts[i];
-
-            split(decl_parts, rhs, is_any_of("="));
-            if (decl_parts.size() < 2)
-                throw "Illegal constant declaration";
-
-            string constant_name = decl_parts[0];
-            trim(constant_name);
-            string value_str = decl_parts[1];
-            trim(value_str);
-
-            if (sym_table.find(constant_name) != sym_table.end())
-                throw "Symbol " + constant_name  +  " already declared";
-            int value = read_numeric<int>(value_str);
-
-            /* Assign constants a temorary input index,
-             * we later add on to this index the number of "variable" inputs.
-             */
-            add_new_constant(constant_name, value);
-        }
-        else if (parts[0] == "include") {
-            if (parts.size() != 2)
-                throw "File must be specified in 'include' statement";
-            trim(parts[1]);
-            if (parts[1][0] != '"' || parts[1][parts[1].length() - 1] != '"')
-                throw "File name must be specified within quotes (\")";
-            string fname = parts[1].substr(1, parts[1].length() - 2);
-            ifstream include_is(fname.c_str());
-            if (!compile(include_is))
-                throw "Failed to load program in file " + fname;
-        }
-        else if (parts[0] == "func") {            
-            string expr = stmnt.substr(parts[0].length(),
-                                           stmnt.length() - parts[0].length());
-            FunctionDesc *func = read_function(expr);
-            if (func->params.size() == 0) {
-                // translate  function to circuit
-                Gate *gate = build_circuit_from_rpn(func->tokens);
-                add_new_function(func, gate);
+    while (parse_statement(lexer))
+        ;
+
+    return true;
+}
+
+/* Returns false at the end of the source */
+bool Compilation::parse_statement(Lexer &lexer)
+{
+    Lexeme keyword = lexer.next();
+    if (keyword.type == LEX_END)
+        return false;
+    if (keyword.type == LEX_NEWLINE)
+        return true;
+    if (keyword.type != LEX_IDENT)
+        throw "Expected a statement";
+
+    if (keyword.text == "input")
+        parse_input(lexer);
+    else if (keyword.text == "constant")
+        parse_constant(lexer);
+    else if (keyword.text == "include")
+        parse_include(lexer);
+    else if (keyword.text == "func")
+        parse_func(lexer);
+    else
+        throw "Unknown statement";
+
+    if (!lexer.accept(LEX_NEWLINE) && lexer.peek().type != LEX_END)
+        throw "Expected end of statement";
+
+    return true;
+}
+
+/* input NAME [ : LENGTH ] */
+void Compilation::parse_input(Lexer &lexer)
+{
+    string var_name(lexer.expect(LEX_IDENT, "Illegal input declaration").text);
+    size_t len = parse_length(lexer);
+
+    if (sym_table.find(var_name) != sym_table.end())
+        throw "Symbol " + var_name  +  " already declared";
+
+    add_new_variable(var_name, len, num_inputs);
+}
+
+/* constant NAME = [-]NUMBER */
+void Compilation::parse_constant(Lexer &lexer)
+{
+    string constant_name(lexer.expect(LEX_IDENT,
+                                      "Illegal constant declaration").text);
+    lexer.expect(LEX_EQUALS, "Illegal constant declaration");
+    bool negative = lexer.accept(LEX_MINUS);
+    int value = parse_number(lexer.expect(LEX_NUMBER,
+                                          "Illegal constant declaration"));
+    if (negative)
+        value = -value;
+
+    if (sym_table.find(constant_name) != sym_table.end())
+        throw "Symbol " + constant_name  +  " already declared";
+
+    /* Assign constants a temorary input index,
+     * we later add on to this index the number of "variable" inputs.
+     */
+    add_new_constant(constant_name, value);
+}
+
+/* include "FILE" */
+void Compilation::parse_include(Lexer &lexer)
+{
+    string fname(lexer.expect(LEX_STRING, "File name must be specified "
+                                          "within quotes (\")").text);
+    ifstream include_is(fname.c_str());
+    if (!include_is.good() || !compile(include_is))
+        throw "Failed to load program in file " + fname;
+}
+
+/* func NAME [ ( PARAM [ : LENGTH ] , ... ) ] = EXPRESSION */
+void Compilation::parse_func(Lexer &lexer)
+{
+    FunctionDesc *f = new FunctionDesc;
+    f->name = string(lexer.expect(LEX_IDENT,
+                                  "Invalid syntax for function definition")
+                                  .text);
+    f->index = provenance.function_names.size();
+    provenance.function_names.push_back(f->name);
+
+    ParamMap params;
+    if (lexer.accept(LEX_LEFT_PAREN) && !lexer.accept(LEX_RIGHT_PAREN)) {
+        do {
+            string_view name = lexer.expect(LEX_IDENT, "Expected parameter")
+                                   .text;
+            bool is_vector = lexer.peek().type == LEX_COLON;
+            ParamInfo param;
+            param.index = f->params.size();
+            param.len = parse_length(lexer);
+            if (!params.emplace(name, param).second)
+                throw "Duplicate parameter";
+
+            if (is_vector) {
+                for (size_t i = 0; i < param.len; i++)
+                    f->params.push_back(array_name(name, i));
             }
             else
-                add_new_function(func);           
-        }
+                f->params.push_back(string(name));
+        } while (lexer.accept(LEX_COMMA));
+        lexer.expect(LEX_RIGHT_PAREN, "Invalid syntax for function definition");
     }
+    lexer.expect(LEX_EQUALS, "Invalid syntax for function definition");
+
+    rpn_tokens.clear();
+    parse_expression(lexer, params, rpn_tokens);
+    f->n_tokens = rpn_tokens.size();
+    f->tokens = arena.allocate_array<Token>(f->n_tokens);
+    copy(rpn_tokens.begin(), rpn_tokens.end(), f->tokens);
+
+    if (f->params.size() == 0) {
+        // translate  function to circuit
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        current_site = new_call_site(f, NO_ORIGIN);
+        Gate *gate = build_circuit_from_rpn(f->tokens, f->n_tokens, NULL, 0);
+        current_site = NO_ORIGIN;
+        chrono::duration<double> d = chrono::steady_clock::now() - start;
+        build_seconds += d.count();
+        add_new_function(f, gate);
+    }
+    else
+        add_new_function(f);
+}
 
-    SymbolTable::iterator itr;
-    for (itr = sym_table.begin(); itr != sym_table.end(); itr++) {
-        SymbolInfo &sym = itr->second;
-        if (sym.type == SYM_CONSTANT)
-            sym.gates[0]->input_index += num_inputs;
+/*
+ * Expressions are emitted as RPN. * has higher precedence than + and both
+ * group to the right, so a + b + c is a + (b + c).
+ */
+void Compilation::parse_expression(Lexer &lexer, const ParamMap &params,
+                                   vector<Token> &output)
+{
+    size_t n_terms = 0;
+    do {
+        parse_product(lexer, params, output);
+        n_terms++;
+    } while (lexer.accept(LEX_PLUS));
+
+    for (size_t i = 1; i < n_terms; i++)
+        output.push_back(Token(TOKEN_OP_ADD));
+}
+
+void Compilation::parse_product(Lexer &lexer, const ParamMap &params,
+                                vector<Token> &output)
+{
+    size_t n_factors = 0;
+    do {
+        parse_factor(lexer, params, output);
+        n_factors++;
+    } while (lexer.accept(LEX_STAR));
+
+    for (size_t i = 1; i < n_factors; i++)
+        output.push_back(Token(TOKEN_OP_MUL));
+}
+
+/* ( EXPRESSION ), NAME, NAME[INDEX] or NAME(ARGUMENTS) */
+void Compilation::parse_factor(Lexer &lexer, const ParamMap &params,
+                               vector<Token> &output)
+{
+    if (lexer.accept(LEX_LEFT_PAREN)) {
+        parse_expression(lexer, params, output);
+        lexer.expect(LEX_RIGHT_PAREN, "Mismatched parenthesis");
+        return;
     }
 
-    return true;
+    string_view name = lexer.expect(LEX_IDENT, "Expected operand").text;
+    bool indexed = lexer.peek().type == LEX_LEFT_BRACKET;
+    unsigned int ind = indexed ? parse_index(lexer) : 0;
+
+    ParamMap::const_iterator pitr = params.find(name);
+    if (pitr != params.end()) {
+        // Handle argument
+        const ParamInfo &param = pitr->second;
+        if (param.len > 1 && !indexed)
+            throw "Expected [";
+        if (ind >= param.len)
+            throw "Index out of range";
+        output.push_back(Token(TOKEN_ARGUMENT, param.index + ind));
+        return;
+    }
+
+    SymbolTable::iterator itr = sym_table.find(name);
+    if (itr == sym_table.end()) {
+        // Assume it is a new variable
+        if (indexed)
+            throw "Undeclared vector";
+        add_new_variable(string(name));
+        output.push_back(Token(sym_table.find(name)->second.gates[0]));
+        return;
+    }
+
+    SymbolInfo &sym = itr->second;
+    switch (sym.type) {
+        case SYM_VARIABLE:
+            if (sym.len > 1 && !indexed)
+                throw "Expected [";
+            if (ind >= sym.len)
+                throw "Index out of range";
+            output.push_back(Token(TOKEN_OPERAND, sym.gates[ind]));
+            break;
+        case SYM_CONSTANT:
+            if (indexed)
+                throw "Constant is not a vector";
+            output.push_back(Token(TOKEN_OPERAND, sym.gates[0]));
+            break;
+        case SYM_FUNCTION:
+            if (indexed)
+                throw "Function is not a vector";
+            if (sym.func->params.size() != 0)
+                parse_call(lexer, sym.func, params, output);
+            else
+                output.push_back(Token(TOKEN_CIRCUIT, sym.gates[0]));
+            break;
+    }
+}
+
+/* The RPN of the arguments, then the call */
+void Compilation::parse_call(Lexer &lexer, FunctionDesc *f,
+                             const ParamMap &params, vector<Token> &output)
+{
+    lexer.expect(LEX_LEFT_PAREN, "FunctionDesc expects arguments");
+
+    size_t n_args = 0;
+    if (lexer.peek().type != LEX_RIGHT_PAREN) {
+        do {
+            n_args += parse_argument(lexer, params, output);
+        } while (lexer.accept(LEX_COMMA));
+    }
+    lexer.expect(LEX_RIGHT_PAREN, "Invalid function call");
+
+    if (n_args != f->params.size())
+        throw "Incorrect number of arguments passed to function";
+    output.push_back(Token(f));
+}
+
+/*
+ * A vector passed by name stands for all its elements. Returns the number
+ * of arguments emitted.
+ */
+size_t Compilation::parse_argument(Lexer &lexer, const ParamMap &params,
+                                   vector<Token> &output)
+{
+    if (lexer.peek().type == LEX_IDENT) {
+        Lexer after = lexer;
+        string_view name = after.next().text;
+        LexemeType follow = after.peek().type;
+
+        if (follow == LEX_COMMA || follow == LEX_RIGHT_PAREN) {
+            ParamMap::const_iterator pitr = params.find(name);
+            SymbolTable::iterator itr = sym_table.find(name);
+            if (pitr != params.end() && pitr->second.len > 1) {
+                const ParamInfo &param = pitr->second;
+                for (size_t i = 0; i < param.len; i++)
+                    output.push_back(Token(TOKEN_ARGUMENT, param.index + i));
+                lexer = after;
+                return param.len;
+            }
+            if (pitr == params.end() && itr != sym_table.end() &&
+                    itr->second.type == SYM_VARIABLE && itr->second.len > 1) {
+                const SymbolInfo &sym = itr->second;
+                for (size_t i = 0; i < sym.len; i++)
+                    output.push_back(Token(TOKEN_OPERAND, sym.gates[i]));
+                lexer = after;
+                return sym.len;
+            }
+        }
+    }
+
+    parse_expression(lexer, params, output);
+
+    return 1;
 }
 
 /* 
@@ -888,12 +1116,6 @@ bool Compilation::compile(std::istream &is)
  * #########################################################
  */
 
-inline bool is_special_char(char c)
-{
-    return c == '(' || c == ')' || c == '*' || c == '+' || c == ';' ||
-           c == '[' || c == ']';
-}
-
 inline bool is_operator(Token token)
 {
     return token.type == TOKEN_OP_ADD || token.type == TOKEN_OP_MUL;
@@ -927,7 +1149,7 @@ void print_circuit(Gate *gate)
         printf("]");
     }
 }
-string print_tokens_rec(list<Token> &tokens)
+string print_tokens_rec(vector<Token> &tokens)
 {
     if (tokens.empty())
         return "";
@@ -947,7 +1169,7 @@ string print_tokens_rec(list<Token> &tokens)
         printf("<CIRCUIT>");
     }
     else if (token.type == TOKEN_ARGUMENT) {
-        return string("<ARGUMENT (") + token.arg_name + ")> ";
+        return "<ARGUMENT (" + to_string(token.arg_index) + ")> ";
     }
     else if (is_operator(token.type)) {
         string out = (token.type == TOKEN_OP_MUL) ? "* [ " : " + [ ";
@@ -963,91 +1185,23 @@ string print_tokens_rec(list<Token> &tokens)
     return "";
 }
 
-string array_name(const string &aname, unsigned int index)
+string array_name(string_view aname, unsigned int index)
 {
-    string name = aname;
- 
-    trim(name);
-    name +=  "[" + lexical_cast<string>(index) + "]";
+    string name(aname);
+
+    name += "[" + to_string(index) + "]";
 
     return name;
 }
 
-string print_tokens(const list<Token> &tokens)
+string print_tokens(const Token *tokens, size_t n_tokens)
 {
-    list<Token> copy = tokens;
+    vector<Token> copy(tokens, tokens + n_tokens);
 
     return print_tokens_rec(copy);
 }
 
 
 
-void instantiate_function(list<Token> &output,
-                          FunctionDesc *f,
-                          map<string,FunctionDesc*> bindings)
-{
-    list<Token>::iterator itr;
-
-    for (itr = f->tokens.begin(); itr != f->tokens.end(); itr++) {
-        Token token = *itr;
-
-        if (token.type == TOKEN_ARGUMENT) {
-            if (bindings.find(token.arg_name) == bindings.end())
-                throw "Argument not bound";
-            output.insert(output.end(),
-                          bindings[token.arg_name]->tokens.begin(),
-                          bindings[token.arg_name]->tokens.end());
-        }
-        else
-            output.push_back(token);
-    }
-}
-
-int parse_array_index(string expr, int pos, unsigned int *index)
-{
-    if (expr[pos] != '[')
-        throw "Expected [";
-    pos++;
-    string sel_str = expr.substr(pos);
-    int endpos = sel_str.find_first_of("]");
-
-    if (endpos == string::npos)
-        throw "Could not find ]";
-    *index = read_numeric<unsigned int>(sel_str.substr(0, endpos));
-
-    return pos + endpos + 1;
-}
-
-int parse_function_call(string expr, int pos, vector<string> &arg_exprs)
-{
-    int begin_pos = pos;
-    string args_str;
-    int paren_depth = 0;
-
-    string current_arg;
-    while (pos < expr.length() && (paren_depth != 0 || expr[pos] != ')')) {
-        if (expr[pos] == ',' && paren_depth == 0) {
-            arg_exprs.push_back(current_arg);
-            current_arg = "";
-        }
-        else {
-            if (expr[pos] == '(')
-                paren_depth++;
-            else if (expr[pos] == ')')
-                paren_depth--;
-            current_arg += expr[pos];
-        }
-        pos++;
-    }
-    if (current_arg != "")
-        arg_exprs.push_back(current_arg);
-    
-    if (expr[pos] != ')') {
-        throw "Invalid function call";
-    }
-
-    return pos;
-}
-
 }
 }
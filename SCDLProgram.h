@@ -7,10 +7,33 @@
 #include <cstdlib>
 #include <iostream>
 #include "Circuit.h"
+#include "Dataflow.h"
+#include "Optimizer.h"
+#include "Provenance.h"
 
 #include <boost/lexical_cast.hpp>
 
 namespace scdl {
+
+class MappedFile;
+class ProgramImage;
+
+/*
+ * Time spent in each phase of compile_program_from_stream. Parsing and the
+ * construction of the gate graph from RPN are interleaved, so parse_seconds
+ * is the time of the front end less build_seconds.
+ */
+struct CompileTimings {
+    CompileTimings()
+        : parse_seconds(0), build_seconds(0), optimize_seconds(0),
+          circuit_seconds(0) {}
+
+    double parse_seconds;
+    double build_seconds;       // build_circuit_from_rpn
+    double optimize_seconds;
+    double circuit_seconds;     // construction of the gate pool
+};
+
 namespace compiler {
 
 struct Constant {
@@ -38,7 +61,15 @@ class SCDLProgram {
     std::string get_variable_name(unsigned int input_index) const;
     size_t get_num_variables() const;
     size_t get_num_variable_inputs() const;
-    Circuit *get_circuit(const std::string &circuit_name) const;
+    /*
+     * A function is an output of the gate pool and is evaluated on the pool
+     * over its cone. Cones are computed on demand and not kept by the
+     * program, so callers that evaluate the same functions many times keep
+     * theirs.
+     */
+    void get_cone(const std::string &circuit_name, CircuitCone &cone) const;
+    void get_cone(const std::vector<std::string> &circuit_names,
+                  CircuitCone &cone) const;
     std::vector<std::string>::const_iterator get_circuit_names() const;
     bool has_circuit(const std::string &circuit_name) const;
     size_t get_num_circuits() const;
@@ -47,39 +78,145 @@ class SCDLProgram {
     bool has_constant(const std::string &const_name) const;
     std::string get_constant_name(unsigned int constant_no) const;
 
-    template <class T>
-    T run(const std::string &circuit_name, T *var_inputs, T *constants) {
-        if (circuit_map.find(circuit_name) == circuit_map.end())
-            throw "Could not find circuit";
-        Circuit *circuit = circuit_map[circuit_name];
-        std::vector<T> inputs;
+    /* Effect of the optimization passes run at compile time */
+    const OptimizeStats &get_optimize_stats() const {
+        return optimize_stats;
+    }
 
-        for (int i = 0; i < n_var_inputs; i++)
-            inputs.push_back(var_inputs[i]);
+    /* All zero for a program loaded from an image */
+    const CompileTimings &get_compile_timings() const {
+        return compile_timings;
+    }
 
-        for (int i =0; i < const_names.size(); i++) {            
-            Constant constant = const_map[const_names[i]];
+    /* What the origins of the gates of the circuits refer to */
+    const Provenance &get_provenance() const {
+        return provenance;
+    }
 
-            inputs.push_back(constants[i]);
+    /*
+     * Every distinct gate of the program, with the functions as outputs in
+     * the order of get_circuit_names(). NULL if there are no functions.
+     */
+    const Circuit *get_gate_pool() const {
+        return gate_pool;
+    }
+
+    /*
+     * Multiplicative depth, gate counts and levels of one function, over
+     * the gates of its cone in the gate pool
+     */
+    CircuitStats get_circuit_stats(const std::string &circuit_name) const;
+
+    /*
+     * The run methods only read the program, so one SCDLProgram can be
+     * shared by any number of threads. If stats is not NULL the evaluation
+     * is added to it (see EvalStats), the copies of the inputs included.
+     * ENGINE_DATAFLOW builds a DataflowExecutor over the gate pool on every
+     * call; a program evaluated many times is better served by its own.
+     */
+    template <class T>
+    T run(const std::string &circuit_name, T *var_inputs, T *constants,
+          EvalEngine engine=ENGINE_RECURSIVE, EvalStats *stats=NULL) const {
+        CircuitCone cone;
+        get_cone(circuit_name, cone);
+        std::vector<T> outputs;
+        run(cone, var_inputs, constants, outputs, engine, stats);
+        return outputs[0];
+    }
+
+    /*
+     * Evaluates the named circuits in a single pass over the union of
+     * their cones, so gates shared between them are computed only once.
+     * outputs[i] receives the value of circuit_names[i].
+     */
+    template <class T>
+    void run(const std::vector<std::string> &circuit_names, T *var_inputs,
+             T *constants, std::vector<T> &outputs,
+             EvalEngine engine=ENGINE_RECURSIVE, EvalStats *stats=NULL) const {
+        // A program without functions has no gate pool
+        if (circuit_names.empty()) {
+            outputs.clear();
+            return;
         }
 
-        return circuit->evaluate(&inputs[0], true);
+        std::vector<T> inputs;
+        make_inputs(var_inputs, constants, inputs);
+        if (stats != NULL)
+            stats->n_copies += inputs.size();
+
+        // All the functions in order are the pool itself
+        if (circuit_names == this->circuit_names) {
+            if (engine == ENGINE_DATAFLOW) {
+                DataflowExecutor executor(gate_pool);
+                executor.evaluate_all(&inputs[0], outputs, stats);
+            }
+            else
+                gate_pool->evaluate_all(&inputs[0], outputs, engine, stats);
+            return;
+        }
+
+        CircuitCone cone;
+        get_cone(circuit_names, cone);
+        evaluate_cone(cone, inputs, outputs, engine, stats);
     }
 
+    /* Same as above over a cone from get_cone */
     template <class T>
-    T run(T *var_inputs, T *constants) {
+    void run(const CircuitCone &cone, T *var_inputs, T *constants,
+             std::vector<T> &outputs, EvalEngine engine=ENGINE_RECURSIVE,
+             EvalStats *stats=NULL) const {
+        std::vector<T> inputs;
+        make_inputs(var_inputs, constants, inputs);
+        if (stats != NULL)
+            stats->n_copies += inputs.size();
+
+        evaluate_cone(cone, inputs, outputs, engine, stats);
+    }
+
+    template <class T>
+    T run(T *var_inputs, T *constants) const {
         return run("out", var_inputs, constants);
     }
 
        
-    static SCDLProgram *compile_program_from_stream(std::istream &in);
+    static SCDLProgram *compile_program_from_stream(std::istream &in,
+        const CompileOptions &options=CompileOptions());
     static SCDLProgram *compile_program_from_file(std::string file_name);
 
  protected:
-    SCDLProgram(std::map<std::string,Gate*> &func_gates,
+    friend class scdl::ProgramImage;
+
+    /* Empty program, filled in by ProgramImage::load */
+    SCDLProgram();
+
+    SCDLProgram(const std::map<std::string,Gate*> &func_gates,
                 std::map<std::string,Variable> &var_map,
-                std::map<std::string,Constant> &const_map);
+                std::map<std::string,Constant> &const_map,
+                const OptimizeStats &optimize_stats,
+                Provenance &provenance);
+
+    template <class T>
+    void evaluate_cone(const CircuitCone &cone, const std::vector<T> &inputs,
+                       std::vector<T> &outputs, EvalEngine engine,
+                       EvalStats *stats) const {
+        if (engine == ENGINE_DATAFLOW) {
+            DataflowExecutor executor(gate_pool);
+            executor.evaluate_cone(cone, &inputs[0], outputs, stats);
+        }
+        else
+            gate_pool->evaluate_cone(cone, &inputs[0], outputs, engine,
+                                     stats);
+    }
 
+    template <class T>
+    void make_inputs(T *var_inputs, T *constants,
+                     std::vector<T> &inputs) const {
+        for (int i = 0; i < n_var_inputs; i++)
+            inputs.push_back(var_inputs[i]);
+
+        for (int i =0; i < const_names.size(); i++)
+            inputs.push_back(constants[i]);
+    }
 
 
  private:
@@ -87,9 +224,16 @@ class SCDLProgram {
     std::vector<std::string> const_names;
     std::map<std::string,Variable> var_map;
     std::vector<std::string> var_names;
-    std::map<std::string,Circuit*> circuit_map;
+    // Output of each function in gate_pool
+    std::map<std::string,unsigned int> output_of;
+    OptimizeStats optimize_stats;
+    CompileTimings compile_timings;
+    Provenance provenance;
     size_t n_var_inputs;
     std::vector<std::string> circuit_names;
+    // The image a loaded program was mapped from
+    MappedFile *image;
+    Circuit *gate_pool;
 
 };
 
@@ -0,0 +1,946 @@
+#include "Circuit.h"
+#include "SCDLProgram.h"
+#include "BitSlice.h"
+#include "Dataflow.h"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include <new>
+#include <atomic>
+#include <utility>
+#include <iterator>
+#include <sys/resource.h>
+
+using namespace scdl;
+
+
+/*
+ * Counts the heap allocations made while compiling. The engines allocate
+ * from several threads, so the count is atomic; only the total matters,
+ * hence the relaxed order.
+ */
+static std::atomic<size_t> n_allocations(0);
+
+static void *counted_alloc(size_t size, size_t alignment)
+{
+    n_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (size == 0)
+        size = 1;
+
+    void *p;
+    if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+        p = malloc(size);
+    else if (posix_memalign(&p, alignment, size) != 0)
+        p = NULL;
+    if (p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new(size_t size)
+{
+    return counted_alloc(size, 0);
+}
+
+void *operator new[](size_t size)
+{
+    return counted_alloc(size, 0);
+}
+
+void *operator new(size_t size, std::align_val_t alignment)
+{
+    return counted_alloc(size, (size_t) alignment);
+}
+
+void *operator new[](size_t size, std::align_val_t alignment)
+{
+    return counted_alloc(size, (size_t) alignment);
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, size_t, std::align_val_t) noexcept
+{
+    free(p);
+}
+
+long peak_rss_kb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+
+/*
+ * Results of one benchmark. With -j they are printed as one JSON object per
+ * line instead of the text report, so that the runs of different versions
+ * can be compared by a script.
+ */
+class Report {
+ public:
+    void add_string(const std::string &key, const std::string &value) {
+        std::string quoted = "\"";
+        for (size_t i = 0; i < value.size(); i++) {
+            if (value[i] == '"' || value[i] == '\\')
+                quoted += '\\';
+            quoted += value[i];
+        }
+        fields.push_back(std::make_pair(key, quoted + "\""));
+    }
+
+    void add_number(const std::string &key, double value) {
+        std::ostringstream os;
+        if (std::isfinite(value))
+            os << value;
+        else
+            os << "null";   // a rate over a time too short to measure
+        fields.push_back(std::make_pair(key, os.str()));
+    }
+
+    void add_count(const std::string &key, size_t value) {
+        fields.push_back(std::make_pair(key, std::to_string(value)));
+    }
+
+    void print(std::ostream &out) const {
+        out << "{";
+        for (size_t i = 0; i < fields.size(); i++) {
+            out << ((i > 0) ? ", \"" : "\"") << fields[i].first << "\": "
+                << fields[i].second;
+        }
+        out << "}" << std::endl;
+    }
+
+ private:
+    std::vector<std::pair<std::string,std::string> > fields;
+};
+
+// Set with -j
+static bool json_output = false;
+
+// Set with -o, all the functions if empty
+static std::vector<std::string> outputs;
+
+// The text report, discarded with -j
+static std::ostream null_stream(NULL);
+static std::ostream *text = &std::cout;
+
+
+struct EngineDesc {
+    EvalEngine engine;
+    const char *name;
+};
+
+static const EngineDesc engines[] = {
+    {ENGINE_RECURSIVE, "recursive"},
+    {ENGINE_ITERATIVE, "iterative"},
+    {ENGINE_LEVELED, "leveled"}
+};
+
+static const size_t n_engines = sizeof(engines) / sizeof(engines[0]);
+
+
+/* Plaintext bits evaluated with integer arithmetic as SCDLEvaluator does */
+struct IntBit {
+    int bit;
+
+    IntBit(int bit) : bit(bit) {}
+
+    IntBit &operator*=(const IntBit &other) {
+        bit = (bit * other.bit) % 2;
+        return *this;
+    }
+
+    IntBit &operator+=(const IntBit &other) {
+        bit = (bit + other.bit) % 2;
+        return *this;
+    }
+};
+
+/*
+ * Stand-in for a homomorphic ciphertext: holds a plaintext bit but burns a
+ * configurable amount of work on every operation, multiplications being
+ * much more expensive than additions.
+ */
+struct CostlyBit {
+    static long mult_cost;
+
+    int bit;
+
+    CostlyBit(int bit) : bit(bit) {}
+
+    CostlyBit &operator*=(const CostlyBit &other) {
+        spin(mult_cost);
+        bit &= other.bit;
+        return *this;
+    }
+
+    CostlyBit &operator+=(const CostlyBit &other) {
+        spin(mult_cost / 100);
+        bit ^= other.bit;
+        return *this;
+    }
+
+    static void spin(long n) {
+        volatile long sink = 0;
+        for (long i = 0; i < n; i++)
+            sink += i;
+    }
+};
+
+long CostlyBit::mult_cost = 0;
+
+
+double elapsed_seconds(std::chrono::steady_clock::time_point start)
+{
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+    return d.count();
+}
+
+/* Names of all the functions of the program, in the order of the pool */
+static std::vector<std::string> all_circuits(compiler::SCDLProgram *prog)
+{
+    std::vector<std::string>::const_iterator names = prog->get_circuit_names();
+    return std::vector<std::string>(names, names + prog->get_num_circuits());
+}
+
+/*
+ * Evaluates all the circuits of the program iterations times with the given
+ * engine, in one pass over the gate pool each time, and prints the time
+ * taken along with the number of gates evaluated per second. Returns the
+ * time taken.
+ */
+template <class T>
+double bench_engine(compiler::SCDLProgram *prog, const EngineDesc &engine,
+                    std::vector<T> &bit_inputs, std::vector<T> &bit_constants,
+                    size_t n_gates, int iterations, Report &report)
+{
+    std::vector<std::string> names = all_circuits(prog);
+    std::vector<T> values;
+    int checksum = 0;
+
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++) {
+        prog->run(names, &bit_inputs[0], &bit_constants[0], values,
+                  engine.engine);
+        for (size_t c = 0; c < values.size(); c++)
+            checksum += values[c].bit;
+    }
+    double secs = elapsed_seconds(start);
+
+    *text << "  " << engine.name << ": " << secs << " s, "
+              << (n_gates * (double) iterations) / secs << " gates/s"
+              << " (checksum " << checksum << ")" << std::endl;
+
+    std::string key(engine.name);
+    report.add_number(key + "_s", secs);
+    report.add_number(key + "_gates_per_s", (n_gates * (double) iterations)
+                                            / secs);
+
+    return secs;
+}
+
+template <class T>
+double bench_dataflow(compiler::SCDLProgram *prog, std::vector<T> &bit_inputs,
+                      std::vector<T> &bit_constants, size_t n_gates,
+                      int iterations, Report &report)
+{
+    DataflowExecutor executor(prog->get_gate_pool());
+
+    // Same input layout as SCDLProgram::run
+    std::vector<T> inputs;
+    for (size_t i = 0; i < prog->get_num_variable_inputs(); i++)
+        inputs.push_back(bit_inputs[i]);
+    for (size_t i = 0; i < prog->get_num_constants(); i++)
+        inputs.push_back(bit_constants[i]);
+    inputs.push_back(T(0));
+
+    std::vector<T> values;
+    int checksum = 0;
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++) {
+        executor.evaluate_all(&inputs[0], values);
+        for (size_t c = 0; c < values.size(); c++)
+            checksum += values[c].bit;
+    }
+    double secs = elapsed_seconds(start);
+
+    *text << "  dataflow (" << executor.get_num_threads()
+          << " threads): " << secs << " s, "
+          << (n_gates * (double) iterations) / secs << " gates/s"
+          << " (checksum " << checksum << ")" << std::endl;
+
+    report.add_count("dataflow_threads", executor.get_num_threads());
+    report.add_number("dataflow_s", secs);
+    report.add_number("dataflow_gates_per_s", (n_gates * (double) iterations)
+                                              / secs);
+
+    return secs;
+}
+
+template <class T>
+void bench_engines(compiler::SCDLProgram *prog, size_t n_gates,
+                   int iterations, Report &report)
+{
+    size_t n_bit_inputs = prog->get_num_variable_inputs();
+    size_t n_bit_constants = prog->get_num_constants();
+    std::vector<T> bit_inputs;
+    std::vector<T> bit_constants;
+
+    srand(1);
+    for (size_t i = 0; i < n_bit_inputs; i++)
+        bit_inputs.push_back(T(rand() % 2));
+    for (size_t i = 0; i < n_bit_constants; i++)
+        bit_constants.push_back(T(prog->get_constant(i).value % 2));
+    // keep &v[0] valid for programs without inputs or constants
+    bit_inputs.push_back(T(0));
+    bit_constants.push_back(T(0));
+
+    double serial = 0;
+    for (size_t e = 0; e < n_engines; e++) {
+        double secs = bench_engine(prog, engines[e], bit_inputs,
+                                   bit_constants, n_gates, iterations, report);
+        if (engines[e].engine == ENGINE_ITERATIVE)
+            serial = secs;
+        else if (serial > 0)
+            *text << "    speedup over iterative: " << serial / secs
+                  << std::endl;
+    }
+
+    double secs = bench_dataflow(prog, bit_inputs, bit_constants, n_gates,
+                                 iterations, report);
+    *text << "    speedup over iterative: " << serial / secs << std::endl;
+}
+
+void bench_bitsliced(compiler::SCDLProgram *prog, size_t n_gates,
+                     int iterations, Report &report)
+{
+    // The bit-sliced backend covers iterations assignments in fewer passes
+    BitSliceEvaluator slicer(prog);
+    size_t n_lanes = slicer.get_num_lanes();
+    size_t n_passes = (iterations + n_lanes - 1) / n_lanes;
+    std::vector<uint64_t> results;
+    CircuitCone cone;
+    prog->get_cone(all_circuits(prog), cone);
+
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    for (size_t it = 0; it < n_passes; it++)
+        slicer.run(cone, results);
+    double secs = elapsed_seconds(start);
+
+    *text << "  bitsliced (" << n_lanes << " lanes): " << secs << " s, "
+          << (n_gates * (double) n_passes * n_lanes) / secs
+          << " gates/s" << std::endl;
+
+    report.add_count("bitsliced_lanes", n_lanes);
+    report.add_number("bitsliced_s", secs);
+    report.add_number("bitsliced_gates_per_s",
+                      (n_gates * (double) n_passes * n_lanes) / secs);
+}
+
+/*
+ * Compiles the program, reporting the time of every phase, then evaluates
+ * all its circuits with each engine. The rates are of distinct gates, each
+ * evaluated once per pass over the gate pool.
+ */
+void bench_program(const std::string &name, const std::string &source,
+                   int iterations)
+{
+    Report report;
+    report.add_string("program", name);
+
+    std::istringstream scdl_in(source);
+    size_t n_before = n_allocations;
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    CompileOptions options;
+    options.outputs = outputs;
+    compiler::SCDLProgram *prog =
+        compiler::SCDLProgram::compile_program_from_stream(scdl_in, options);
+    double compile_secs = elapsed_seconds(start);
+    size_t n_compile_allocations = n_allocations - n_before;
+    size_t compile_rss = peak_rss_kb();
+
+    // Gates counted once per circuit that depends on them
+    size_t n_gates = 0;
+    const Circuit *pool = prog->get_gate_pool();
+    std::vector<std::string>::const_iterator names = prog->get_circuit_names();
+    for (size_t c = 0; c < prog->get_num_circuits(); c++) {
+        CircuitCone cone;
+        prog->get_cone(names[c], cone);
+        for (size_t k = 0; k < cone.get_num_gates(); k++) {
+            GateType type = pool->get_gate_type(cone.get_gate_index(k));
+            if (type == GATE_MULT || type == GATE_ADD)
+                n_gates++;
+        }
+    }
+    size_t n_pool_gates = 0;
+    size_t max_values = 0;
+    size_t max_slots = 0;
+    if (pool != NULL) {
+        n_pool_gates = pool->get_num_add_gates() +
+                       pool->get_num_mult_gates();
+        max_values = pool->get_num_gates();
+        max_slots = pool->get_num_slots();
+    }
+
+    const CompileTimings &timings = prog->get_compile_timings();
+    *text << name << ": " << prog->get_num_circuits() << " circuits, "
+          << n_gates << " gates, " << n_pool_gates << " distinct"
+          << std::endl;
+    *text << "  compile: " << compile_secs << " s, "
+          << n_compile_allocations << " allocations, peak RSS "
+          << compile_rss << " KB" << std::endl;
+    *text << "    parse " << timings.parse_seconds << " s, build "
+          << timings.build_seconds << " s, optimize "
+          << timings.optimize_seconds << " s, gate pool "
+          << timings.circuit_seconds << " s" << std::endl;
+    *text << "  peak live values: " << max_slots << " (of "
+          << max_values << " stored per evaluation before)" << std::endl;
+
+    report.add_count("source_bytes", source.size());
+    report.add_count("circuits", prog->get_num_circuits());
+    report.add_count("gates", n_gates);
+    report.add_count("pool_gates", n_pool_gates);
+    report.add_number("compile_s", compile_secs);
+    report.add_number("parse_s", timings.parse_seconds);
+    report.add_number("build_s", timings.build_seconds);
+    report.add_number("optimize_s", timings.optimize_seconds);
+    report.add_number("circuit_s", timings.circuit_seconds);
+    report.add_count("compile_allocations", n_compile_allocations);
+    report.add_count("compile_rss_kb", compile_rss);
+    report.add_count("peak_live_values", max_slots);
+    report.add_count("iterations", iterations);
+
+    if (CostlyBit::mult_cost > 0) {
+        report.add_count("mult_cost", CostlyBit::mult_cost);
+        bench_engines<CostlyBit>(prog, n_pool_gates, iterations, report);
+    }
+    else {
+        bench_engines<IntBit>(prog, n_pool_gates, iterations, report);
+        bench_bitsliced(prog, n_pool_gates, iterations, report);
+    }
+    report.add_count("peak_rss_kb", peak_rss_kb());
+
+    if (json_output)
+        report.print(std::cout);
+
+    delete prog;
+}
+
+/*
+ * #########################################################
+ * Generators of scalable programs
+ * #########################################################
+ */
+
+/* The part of base.scdl the generated programs use */
+static const char *generator_library =
+    "constant one = 1\n"
+    "func not(x) = x + one\n"
+    "func eq(x, y) = (x + y) + one\n"
+    "func mux(x, y, z) = x*y + not(x)*z\n";
+
+/* Bit i of the elements of a vector, the most significant bit last */
+typedef std::vector<std::string> Bits;
+
+static Bits input_bits(const std::string &name, size_t n_bits)
+{
+    Bits bits;
+    for (size_t i = 0; i < n_bits; i++)
+        bits.push_back(name + "[" + std::to_string(i) + "]");
+    return bits;
+}
+
+/* X > Y for unsigned X and Y, as in gt.scdl but for any width */
+static void write_gt(std::ostream &os, size_t n_bits)
+{
+    os << "func gt(X : " << n_bits << ", Y : " << n_bits << ") = ";
+    for (size_t i = n_bits; i-- > 1; ) {
+        os << "X[" << i << "]*not(Y[" << i << "]) + eq(X[" << i << "], Y["
+           << i << "])*(";
+    }
+    os << "X[0]*not(Y[0])" << std::string(n_bits - 1, ')') << "\n";
+}
+
+static std::string call_gt(const Bits &x, const Bits &y)
+{
+    std::string call = "gt(";
+    for (size_t i = 0; i < x.size(); i++)
+        call += x[i] + ", ";
+    for (size_t i = 0; i < y.size(); i++)
+        call += y[i] + ((i + 1 < y.size()) ? ", " : ")");
+    return call;
+}
+
+/* A function for every bit of mux(select, x, y), named prefix_i */
+static Bits write_mux(std::ostream &os, const std::string &prefix,
+                      const std::string &select, const Bits &x,
+                      const Bits &y)
+{
+    Bits bits;
+    for (size_t i = 0; i < x.size(); i++) {
+        bits.push_back(prefix + "_" + std::to_string(i));
+        os << "func " << bits.back() << " = mux(" << select << ", " << x[i]
+           << ", " << y[i] << ")\n";
+    }
+    return bits;
+}
+
+static void write_outputs(std::ostream &os, const std::string &prefix,
+                          const Bits &bits)
+{
+    for (size_t i = 0; i < bits.size(); i++)
+        os << "func " << prefix << i << " = " << bits[i] << "\n";
+}
+
+/* Ripple-carry adder of two n-bit inputs, n + 1 output bits */
+std::string generate_adder(const size_t *params)
+{
+    size_t n = params[0];
+    std::ostringstream os;
+
+    os << generator_library << "input A : " << n << "\ninput B : " << n
+       << "\n";
+    os << "func c0 = A[0]*B[0]\nfunc out0 = A[0] + B[0]\n";
+    for (size_t i = 1; i < n; i++) {
+        os << "func out" << i << " = A[" << i << "] + B[" << i << "] + c"
+           << i - 1 << "\n";
+        os << "func c" << i << " = A[" << i << "]*B[" << i << "] + c" << i - 1
+           << "*(A[" << i << "] + B[" << i << "])\n";
+    }
+    os << "func out" << n << " = c" << n - 1 << "\n";
+
+    return os.str();
+}
+
+/* A > B for two n-bit inputs */
+std::string generate_comparator(const size_t *params)
+{
+    size_t n = params[0];
+    std::ostringstream os;
+
+    os << generator_library;
+    write_gt(os, n);
+    os << "input A : " << n << "\ninput B : " << n << "\n"
+       << "func out = gt(A, B)\n";
+
+    return os.str();
+}
+
+/* Number of k n-bit inputs B0, ..., B(k-1) greater than A, as gt_count.scdl */
+std::string generate_counter(const size_t *params)
+{
+    size_t k = params[0];
+    size_t n = params[1];
+    std::ostringstream os;
+
+    os << generator_library;
+    write_gt(os, n);
+    os << "input A : " << n << "\n";
+
+    // Each comparison is added to the count so far with a chain of half
+    // adders
+    Bits count;
+    for (size_t j = 0; j < k; j++) {
+        std::string b = "B" + std::to_string(j);
+        os << "input " << b << " : " << n << "\n";
+        os << "func g" << j << " = " << call_gt(input_bits(b, n),
+                                                 input_bits("A", n)) << "\n";
+
+        std::string carry = "g" + std::to_string(j);
+        Bits next;
+        for (size_t i = 0; i <= count.size(); i++) {
+            std::string bit = "s" + std::to_string(j) + "_" +
+                              std::to_string(i);
+            if (i == count.size()) {
+                if ((j + 1) >> i == 0)
+                    break;
+                os << "func " << bit << " = " << carry << "\n";
+            }
+            else {
+                os << "func " << bit << " = " << count[i] << " + " << carry
+                   << "\n";
+                if (((j + 1) >> (i + 1)) != 0) {
+                    std::string next_carry = "k" + std::to_string(j) + "_" +
+                                             std::to_string(i);
+                    os << "func " << next_carry << " = " << count[i] << "*"
+                       << carry << "\n";
+                    carry = next_carry;
+                }
+            }
+            next.push_back(bit);
+        }
+        count = next;
+    }
+    write_outputs(os, "out", count);
+
+    return os.str();
+}
+
+/* Largest of k n-bit inputs X0, ..., X(k-1) */
+std::string generate_max(const size_t *params)
+{
+    size_t k = params[0];
+    size_t n = params[1];
+    std::ostringstream os;
+
+    os << generator_library;
+    write_gt(os, n);
+
+    Bits max = input_bits("X0", n);
+    os << "input X0 : " << n << "\n";
+    for (size_t j = 1; j < k; j++) {
+        std::string x = "X" + std::to_string(j);
+        std::string select = "sel" + std::to_string(j);
+        os << "input " << x << " : " << n << "\n";
+        os << "func " << select << " = " << call_gt(input_bits(x, n), max)
+           << "\n";
+        max = write_mux(os, "m" + std::to_string(j), select, input_bits(x, n),
+                        max);
+    }
+    write_outputs(os, "out", max);
+
+    return os.str();
+}
+
+/* Odd-even transposition sort of k n-bit inputs X0, ..., X(k-1) */
+std::string generate_sort(const size_t *params)
+{
+    size_t k = params[0];
+    size_t n = params[1];
+    std::ostringstream os;
+
+    os << generator_library;
+    write_gt(os, n);
+
+    std::vector<Bits> values;
+    for (size_t j = 0; j < k; j++) {
+        std::string x = "X" + std::to_string(j);
+        os << "input " << x << " : " << n << "\n";
+        values.push_back(input_bits(x, n));
+    }
+
+    for (size_t round = 0; round < k; round++) {
+        for (size_t j = round % 2; j + 1 < k; j += 2) {
+            std::string id = std::to_string(round) + "_" + std::to_string(j);
+            std::string swap = "swap" + id;
+            os << "func " << swap << " = "
+               << call_gt(values[j], values[j + 1]) << "\n";
+            Bits low = write_mux(os, "lo" + id, swap, values[j + 1],
+                                 values[j]);
+            Bits high = write_mux(os, "hi" + id, swap, values[j],
+                                  values[j + 1]);
+            values[j] = low;
+            values[j + 1] = high;
+        }
+    }
+    for (size_t j = 0; j < k; j++)
+        write_outputs(os, "out" + std::to_string(j) + "_", values[j]);
+
+    return os.str();
+}
+
+/*
+ * Random layered DAG: l layers of w functions, each over three functions
+ * of the layer below, and a sum of the last layer
+ */
+std::string generate_random(const size_t *params)
+{
+    size_t w = params[0];
+    size_t l = params[1];
+    std::ostringstream os;
+
+    if (w < 3)
+        throw "Random DAG needs a width of at least 3";
+
+    os << "input x : " << w << "\n";
+    Bits prev = input_bits("x", w);
+    srand(7);
+    for (size_t layer = 0; layer < l; layer++) {
+        Bits cur;
+        for (size_t i = 0; i < w; i++) {
+            size_t a = rand() % w;
+            size_t b = (a + 1 + rand() % (w - 1)) % w;
+            size_t c = rand() % w;
+            cur.push_back("g" + std::to_string(layer) + "_" +
+                          std::to_string(i));
+            os << "func " << cur.back() << " = " << prev[a] << " * "
+               << prev[b] << " + " << prev[c] << "\n";
+        }
+        prev = cur;
+    }
+    os << "func out = ";
+    for (size_t i = 0; i < prev.size(); i++)
+        os << ((i > 0) ? " + " : "") << prev[i];
+    os << "\n";
+
+    return os.str();
+}
+
+/*
+ * Chain of n functions g_i = g_(i-1)*A[..] + B[..], each using the one
+ * before, the shape of a ripple carry. Its optimization time should grow
+ * linearly with n.
+ */
+std::string generate_chain(const size_t *params)
+{
+    size_t n = params[0];
+    const size_t n_inputs = 64;
+    std::ostringstream os;
+
+    os << "input A : " << n_inputs << "\ninput B : " << n_inputs << "\n"
+       << "func g0 = A[0]*B[0]\n";
+    for (size_t i = 1; i < n; i++) {
+        os << "func g" << i << " = g" << i - 1 << "*A[" << i % n_inputs
+           << "] + B[" << (7 * i) % n_inputs << "]\n";
+    }
+
+    return os.str();
+}
+
+struct GeneratorDesc {
+    const char *name;
+    const char *params;
+    size_t n_params;
+    std::string (*generate)(const size_t *params);
+};
+
+static const GeneratorDesc generators[] = {
+    {"adder", "<bits>", 1, generate_adder},
+    {"comparator", "<bits>", 1, generate_comparator},
+    {"counter", "<values>:<bits>", 2, generate_counter},
+    {"max", "<values>:<bits>", 2, generate_max},
+    {"sort", "<values>:<bits>", 2, generate_sort},
+    {"random", "<width>:<layers>", 2, generate_random},
+    {"chain", "<length>", 1, generate_chain}
+};
+
+static const size_t n_generators = sizeof(generators) /
+                                   sizeof(generators[0]);
+
+/* spec is name:param[:param], such as adder:64 or sort:8:16 */
+std::string generate_program(const std::string &spec)
+{
+    std::vector<size_t> params;
+    size_t colon = spec.find(':');
+    std::string name = spec.substr(0, colon);
+    while (colon != std::string::npos) {
+        size_t next = spec.find(':', colon + 1);
+        long param = atol(spec.substr(colon + 1, next - colon - 1).c_str());
+        if (param <= 0)
+            throw "Generator parameters must be positive";
+        params.push_back(param);
+        colon = next;
+    }
+
+    for (size_t i = 0; i < n_generators; i++) {
+        if (name == generators[i].name) {
+            if (params.size() != generators[i].n_params)
+                throw "Wrong number of generator parameters";
+            return generators[i].generate(&params[0]);
+        }
+    }
+    throw "Unknown generator";
+}
+
+/*
+ * Program of n_lines lines: a small library, the inputs, and zero-parameter
+ * functions of bounded size over the inputs and the library, so that the
+ * time to compile it grows with the front end and not with the circuits.
+ */
+std::string synthetic_program(size_t n_lines)
+{
+    const size_t n_inputs = 64;
+    const char *calls[] = {"or", "eq", "maj", "mux"};
+
+    std::ostringstream os;
+    os << "constant one = 1\n"
+       << "func not(x) = x + one\n"
+       << "func or(x, y) = x + y + (x*y)\n"
+       << "func eq(x, y) = (x + y) + one\n"
+       << "func maj(x, y, z) = or(not(x)*y*z, x*or(not(y)*z, y))\n"
+       << "func mux(x, y, z) = or(not(x)*z, x*y)\n"
+       << "input A : " << n_inputs << "\n"
+       << "input B : " << n_inputs << "\n";
+
+    srand(1);
+    for (size_t i = 8; i < n_lines; i++) {
+        const char *f = calls[rand() % 4];
+        int n_args = (f[0] == 'm') ? 3 : 2;
+
+        os << "func g" << i << " = " << f << "(";
+        for (int j = 0; j < n_args; j++) {
+            if (j > 0)
+                os << ", ";
+            os << "A[" << rand() % n_inputs << "]*not(B["
+               << rand() % n_inputs << "]) + B[" << rand() % n_inputs << "]";
+        }
+        os << ")\n";
+    }
+
+    return os.str();
+}
+
+/* Compiles a synthetic program without optimization, reports lines/s */
+void bench_compile(size_t n_lines)
+{
+    std::istringstream is(synthetic_program(n_lines));
+    CompileOptions options;
+    options.optimize = false;
+    options.outputs = outputs;
+
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    compiler::SCDLProgram *prog =
+        compiler::SCDLProgram::compile_program_from_stream(is, options);
+    double secs = elapsed_seconds(start);
+
+    const CompileTimings &timings = prog->get_compile_timings();
+    *text << "synthetic program: " << n_lines << " lines, "
+          << prog->get_num_circuits() << " circuits" << std::endl;
+    *text << "  compile: " << secs << " s, " << n_lines / secs
+          << " lines/s, peak RSS " << peak_rss_kb() << " KB" << std::endl;
+    *text << "    parse " << timings.parse_seconds << " s, build "
+          << timings.build_seconds << " s, circuits "
+          << timings.circuit_seconds << " s" << std::endl;
+
+    if (json_output) {
+        Report report;
+        report.add_string("program", "synthetic:" + std::to_string(n_lines));
+        report.add_count("circuits", prog->get_num_circuits());
+        report.add_number("compile_s", secs);
+        report.add_number("parse_s", timings.parse_seconds);
+        report.add_number("build_s", timings.build_seconds);
+        report.add_number("circuit_s", timings.circuit_seconds);
+        report.add_number("lines_per_s", n_lines / secs);
+        report.add_count("peak_rss_kb", peak_rss_kb());
+        report.print(std::cout);
+    }
+
+    delete prog;
+}
+
+void usage(const char *name)
+{
+    std::cerr << "usage: " << name << " [-j] [-c <mult_cost>] "
+              << "[-o <function>]... [-g <generator>:<params>]... "
+              << "<iterations> [<filename>...]" << std::endl
+              << "       " << name << " [-j] [-o <function>]... -p <lines>"
+              << std::endl
+              << "-j prints one JSON object per program instead of text"
+              << std::endl
+              << "-o keeps only the given functions" << std::endl
+              << "generators:" << std::endl;
+    for (size_t i = 0; i < n_generators; i++) {
+        std::cerr << "  " << generators[i].name << ":"
+                  << generators[i].params << std::endl;
+    }
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::string> specs;
+    long n_lines = 0;
+    int arg = 1;
+
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (!strcmp(argv[arg], "-j"))
+            json_output = true;
+        else if (arg + 1 == argc)
+            usage(argv[0]);
+        else if (!strcmp(argv[arg], "-c"))
+            CostlyBit::mult_cost = atol(argv[++arg]);
+        else if (!strcmp(argv[arg], "-g"))
+            specs.push_back(argv[++arg]);
+        else if (!strcmp(argv[arg], "-o"))
+            outputs.push_back(argv[++arg]);
+        else if (!strcmp(argv[arg], "-p"))
+            n_lines = atol(argv[++arg]);
+        else
+            usage(argv[0]);
+    }
+
+    if (json_output)
+        text = &null_stream;
+
+    if (n_lines > 0) {
+        try {
+            bench_compile(n_lines);
+        }
+        catch (const char *e) {
+            std::cout << e << std::endl;
+        }
+        return 0;
+    }
+
+    if (arg == argc || (arg + 1 == argc && specs.empty()))
+        usage(argv[0]);
+
+    int iterations = atoi(argv[arg++]);
+
+    try {
+        for (size_t i = 0; i < specs.size(); i++)
+            bench_program(specs[i], generate_program(specs[i]), iterations);
+
+        for (; arg < argc; arg++) {
+            std::ifstream scdl_in(argv[arg]);
+            if (!scdl_in.good()) {
+                std::cerr << argv[arg] << " not found" << std::endl;
+                continue;
+            }
+            std::string source((std::istreambuf_iterator<char>(scdl_in)),
+                               std::istreambuf_iterator<char>());
+            bench_program(argv[arg], source, iterations);
+        }
+    }
+    catch (const char *e) {
+        std::cout << e << std::endl;
+    }
+
+    return 0;
+}
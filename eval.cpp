@@ -2,7 +2,13 @@
 #include "Circuit.h"
 #include "SCDLProgram.h"
 #include "SCDLEvaluator.h"
+#include "ProgramImage.h"
+#include "CompileCache.h"
+#include "Batch.h"
+#include "Provenance.h"
 #include <fstream>
+#include <iterator>
+#include <cstring>
 #include <stdint.h>
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
@@ -11,41 +17,262 @@
 using namespace scdl;
 
 
+// Set with -C
+CompileCache *cache = NULL;
 
-void run(const std::string &scdl_file)
+// Set with -m and -d
+CompileOptions compile_options;
+
+/*
+ * Compiles scdl_file with its .vars file, or loads them from a program
+ * image or from the compile cache. Returns false if a file is missing.
+ */
+bool load(const std::string &scdl_file, CompilerResult &result)
 {
+    if (ProgramImage::is_image(scdl_file)) {
+        result = ProgramImage::load(scdl_file);
+        return true;
+    }
+
     std::ifstream scdl_in(scdl_file.c_str());
     if (!scdl_in.good()) {
         std::cerr << scdl_file << " not found" << std::endl;
-        return;
+        return false;
     }
     
     std::ifstream vars_in((scdl_file + ".vars").c_str());
     if (!vars_in.good()) {
         vars_in.close();
         std::cerr << "No .vars file found" << std::endl;
+        return false;
+    }
+
+    if (cache != NULL) {
+        std::string source((std::istreambuf_iterator<char>(scdl_in)),
+                           std::istreambuf_iterator<char>());
+        std::string vars_source((std::istreambuf_iterator<char>(vars_in)),
+                                std::istreambuf_iterator<char>());
+        result = cache->compile(source, vars_source, compile_options);
+
+        const CacheStats &stats = cache->get_stats();
+        std::cerr << "Compile cache: " << stats.n_hits << " hits, "
+                  << stats.n_misses << " misses, " << stats.n_errors
+                  << " errors" << std::endl;
+        return true;
+    }
+
+    result = SCDLEvaluator::compile(scdl_in, vars_in, compile_options);
+    return true;
+}
+
+/*
+ * Evaluates the program interactively. With a stats_file, statistics of
+ * the evaluation are written to it as JSON ("-" for the standard output).
+ */
+void run(const std::string &scdl_file, EvalEngine engine,
+         const char *stats_file)
+{
+    CompilerResult result;
+    if (!load(scdl_file, result))
         return;
+
+    std::ofstream stats_file_out;
+    std::ostream *stats_out = NULL;
+    if (stats_file != NULL && strcmp(stats_file, "-")) {
+        stats_file_out.open(stats_file);
+        if (!stats_file_out.good()) {
+            std::cerr << "Could not write " << stats_file << std::endl;
+            delete result.program;
+            return;
+        }
+        stats_out = &stats_file_out;
     }
+    else if (stats_file != NULL)
+        stats_out = &std::cout;
 
-    CompilerResult result = SCDLEvaluator::compile(scdl_in, vars_in);
-    SCDLEvaluator::evaluate(result);
+    try {
+        SCDLEvaluator::evaluate(result, engine, stats_out);
+    }
+    catch (const char *) {
+        delete result.program;
+        throw;
+    }
+
+    delete result.program;
+}
+
+/*
+ * Evaluates every record of batch_file ("-" for the standard input) and
+ * writes the outputs to the standard output
+ */
+void run_batch(const std::string &scdl_file, const std::string &batch_file,
+               BatchFormat format)
+{
+    CompilerResult result;
+    if (!load(scdl_file, result))
+        return;
+
+    std::ifstream batch_in;
+    if (batch_file != "-") {
+        batch_in.open(batch_file.c_str());
+        if (!batch_in.good()) {
+            std::cerr << batch_file << " not found" << std::endl;
+            delete result.program;
+            return;
+        }
+    }
+
+    try {
+        BatchEvaluator batch(result.program, result.vars, format);
+        BatchStats stats = batch.run((batch_file != "-") ? batch_in : std::cin,
+                                     std::cout);
+        std::cerr << "Evaluated " << stats.n_records << " records in "
+                  << stats.seconds << " s ("
+                  << stats.n_records / stats.seconds << " records/s)"
+                  << std::endl;
+    }
+    catch (const char *) {
+        delete result.program;
+        throw;
+    }
+
+    delete result.program;
+}
+
+/* Writes the program and its .vars metadata to a program image */
+void save(const std::string &scdl_file, const std::string &image_file)
+{
+    CompilerResult result;
+    if (!load(scdl_file, result))
+        return;
+
+    ProgramImage::save(result.program, &result.vars, image_file);
+    std::cout << "Wrote " << image_file << std::endl;
+
+    delete result.program;
+}
+
+/*
+ * Writes the cost of each SCDL function in the cone of the output
+ * wires to report_file ("-" for the standard output)
+ */
+void report(const std::string &scdl_file, const std::string &report_file)
+{
+    CompilerResult result;
+    if (!load(scdl_file, result))
+        return;
+
+    std::ofstream report_out;
+    if (report_file != "-") {
+        report_out.open(report_file.c_str());
+        if (!report_out.good()) {
+            std::cerr << "Could not write " << report_file << std::endl;
+            delete result.program;
+            return;
+        }
+    }
+
+    try {
+        std::vector<std::string> wires = output_wires(result.vars);
+        if (wires.empty())
+            throw "No output wires";
+        const compiler::SCDLProgram *prog = result.program;
+        CircuitCone cone;
+        prog->get_cone(wires, cone);
+        const Circuit *pool = prog->get_gate_pool();
+        if (!pool->has_origins())
+            std::cerr << "The gates have no recorded origin" << std::endl;
+
+        CostReport costs(pool, prog->get_provenance(), &cone);
+        costs.print((report_file != "-") ? report_out : std::cout);
+    }
+    catch (const char *) {
+        delete result.program;
+        throw;
+    }
 
     delete result.program;
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc < 2) {
-        std::cerr << "usage: " << argv[0] << " <filename>" << std::endl;
+    const char *image_file = NULL;
+    const char *cache_dir = NULL;
+    const char *batch_file = NULL;
+    const char *batch_format = "csv";
+    const char *engine = "recursive";
+    const char *stats_file = NULL;
+    const char *report_file = NULL;
+    int arg = 1;
+
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        if (!strcmp(argv[arg], "-o"))
+            image_file = argv[arg + 1];
+        else if (!strcmp(argv[arg], "-C"))
+            cache_dir = argv[arg + 1];
+        else if (!strcmp(argv[arg], "-b"))
+            batch_file = argv[arg + 1];
+        else if (!strcmp(argv[arg], "-f"))
+            batch_format = argv[arg + 1];
+        else if (!strcmp(argv[arg], "-e"))
+            engine = argv[arg + 1];
+        else if (!strcmp(argv[arg], "-s"))
+            stats_file = argv[arg + 1];
+        else if (!strcmp(argv[arg], "-r"))
+            report_file = argv[arg + 1];
+        else if (!strcmp(argv[arg], "-m") && !strcmp(argv[arg + 1], "on"))
+            compile_options.minimize_mults = true;
+        else if (!strcmp(argv[arg], "-m") && !strcmp(argv[arg + 1], "off"))
+            compile_options.minimize_mults = false;
+        else if (!strcmp(argv[arg], "-d"))
+            compile_options.target_depth = atoi(argv[arg + 1]);
+        else
+            break;
+    }
+
+    if (argc - arg != 1) {
+        std::cerr << "usage: " << argv[0]
+                  << " [-C <cache_dir>] [-o <image>] [-b <records> "
+                  << "[-f csv|jsonl]] "
+                  << "[-e recursive|iterative|leveled|dataflow] "
+                  << "[-s <stats>] [-r <report>] [-m on|off] [-d <depth>] "
+                  << "<filename>" << std::endl
+                  << "<filename> is an SCDL program with its .vars file "
+                  << "or a program image" << std::endl
+                  << "-b evaluates every record of a file, - for the standard "
+                  << "input" << std::endl
+                  << "-s writes statistics of the evaluation as JSON, - for "
+                  << "the standard output" << std::endl
+                  << "-r writes the gates and depth due to each function "
+                  << "instead of evaluating, - for the standard output"
+                  << std::endl
+                  << "-m off skips the rewriting that reduces the number of "
+                  << "multiplications" << std::endl
+                  << "-d only lowers the multiplicative depth down to the "
+                  << "given target, negative to minimize it (the default)"
+                  << std::endl;
         exit(1);
     }
 
     try {
-        run(argv[1]);
+        if (cache_dir != NULL)
+            cache = new CompileCache(cache_dir);
+
+        if (image_file != NULL)
+            save(argv[arg], image_file);
+        else if (report_file != NULL)
+            report(argv[arg], report_file);
+        else if (batch_file != NULL)
+            run_batch(argv[arg], batch_file,
+                      BatchEvaluator::parse_format(batch_format));
+        else
+            run(argv[arg], SCDLEvaluator::parse_engine(engine), stats_file);
     }
     catch (const char *e) {
         std::cout << e << std::endl;
     }
 
+    delete cache;
+
     return 0;
 }